@@ -0,0 +1,2032 @@
+#pragma once
+#include "../DIS-Emulator/cpu.h"
+#include "../DIS-Emulator/symbols.h"
+#include <vector>
+#include <map>
+#include <span>
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <charconv>
+#include <bit>
+#include <functional>
+#include <optional>
+#include <fstream>
+#include <stdexcept>
+
+#define DISA_MAJOR 1
+#define DISA_MINOR 0
+#define DISA_PATCH 0
+
+//Forward declarations & typedef's
+
+typedef std::runtime_error Except;
+
+enum Instruction : int;
+enum Type : int;
+class AsmArena;
+struct AsmSymbolTable;
+struct AsmData;
+struct AsmArgument;
+struct AsmInstruction;
+static Type GetVarType(std::string_view str);
+static Word GetVarValue(std::string_view str, Type type, AsmSymbolTable& symbols);
+static AsmArgument ParseArgument(std::string_view str, AsmSymbolTable& symbols);
+static Opcode GetOpcode(const AsmInstruction& asmInst);
+static Instruction ParseAssemblyInstruction(std::string_view str);
+static bool IsDirective(Instruction inst);
+static bool IsDataList(Instruction inst);
+static void CheckDirective(const AsmInstruction& asmInst);
+
+//Definitions
+
+enum Instruction : int {
+    INST_NOOP = 0,
+    INST_RESET,         //Reset CPU registers and status
+    INST_HALT,          //Stop CPU
+    INST_ADD,           //Add
+    INST_SUB,           //Subtract
+    INST_MUL,           //Multiply
+    INST_DIV,           //Division
+    INST_CMP,           //Compare
+    INST_INC,           //Increment
+    INST_DEC,           //Decrement
+    INST_UXT,           //Zero extend
+    INST_LSL,           //Logical shift left
+    INST_LSR,           //Logical shift right
+    INST_ROL,           //Rotate left
+    INST_ROR,           //Rotate right
+    INST_AND,           //Bitwise AND
+    INST_OR,            //Bitwise OR
+    INST_XOR,           //Bitwise XOR
+    INST_NOT,           //Bitwise NOT
+    INST_MOV,           //Move
+    INST_BMOV,          //Block move
+    INST_BSET,          //Block fill
+    INST_BCMP,          //Block compare
+    INST_JSR = 0x40,    //Jump to subroutine
+    INST_RTN,           //Return from subroutine
+    INST_JMP,           //Jump program counter
+    INST_JRZ,           //Jump if register is zero
+    INST_JRE,           //Jump if register is equal
+    INST_JRN,           //Jump if register is not equal
+    INST_JRG,           //Jump if register is greater
+    INST_JRGE,          //Jump if register is greater or equal
+    INST_JRL,           //Jump if register is less
+    INST_JRLE,          //Jump if register is less or equal
+    INST_BEQ,           //Branch if equal (zero flag set)
+    INST_BNE,           //Branch if not equal (zero flag clear)
+    INST_BLT,           //Branch if signed less
+    INST_BGE,           //Branch if signed greater or equal
+    INST_BCS,           //Branch if carry set (unsigned less)
+    INST_BCC,           //Branch if carry clear (unsigned greater or equal)
+    INST_BVS,           //Branch if overflow set
+    INST_BVC,           //Branch if overflow clear
+    INST_PUSH,          //Push onto stack
+    INST_POP,           //Pop from stack
+    INST_PUSHS,         //Push status onto stack
+    INST_POPS,          //Pop status from stack
+    INST_SETI,          //Set interrupt
+    INST_CLRI,          //Clear interrupt
+    INST_WAIT,          //Wait for an interrupt
+    INST_RDCYC,         //Read the cycle counter (low 32 bits)
+    INST_RDCYCH,        //Read the cycle counter (high 32 bits)
+    INST_RDINST,        //Read the retired instruction counter (low 32 bits)
+    INST_RDINSTH,       //Read the retired instruction counter (high 32 bits)
+    INST_RTI,           //Return from interrupt
+
+    //Directives (emit data instead of an opcode)
+    INST_TABLE,         //Array of label addresses or word constants
+    INST_BYTE,          //Array of byte constants
+    INST_ASCII,         //Characters of a string, without a terminator
+    INST_FILL,          //Count bytes of a value (0 by default)
+    INST_ALIGN,         //Zero bytes up to the next multiple of a power of two
+
+    Count, //Keep last
+};
+enum Type : int
+{
+    Type_Word,
+    Type_Label,
+    Type_Address,
+    Type_AddressRegister,
+    Type_Register,
+    Type_Byte,          //Word constant narrowed to 8 bits for a short form opcode
+    Type_Relative,      //Label reached through an 8 bit PC relative displacement
+};
+struct AsmData {
+    Type type;
+    Word value;
+    Word memAddress;
+};
+//Bump allocator that owns the source text and the parsed IR for a single ParseAssembly call
+//Everything allocated from it must be trivially destructible, memory is only released with the arena
+class AsmArena {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    void* Allocate(size_t size, size_t alignment) {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        if (cursor == nullptr || padding + size > static_cast<size_t>(end - cursor)) {
+            //Oversized requests get a block of their own so the current block is not wasted
+            size_t blockSize = std::max(BLOCK_SIZE, size + alignment);
+            blocks.emplace_back(std::make_unique<Byte[]>(blockSize));
+            cursor = blocks.back().get();
+            end = cursor + blockSize;
+            padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+
+        Byte* result = cursor + padding;
+        cursor = result + size;
+        bytesUsed += padding + size;
+        return result;
+    }
+
+    template<typename T>
+    std::span<T> AllocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena objects are never destroyed");
+        if (count == 0) {
+            return {};
+        }
+        T* data = static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_value_construct_n(data, count);
+        return { data, count };
+    }
+
+    //Copies a string into the arena, the copy lives as long as the arena
+    std::span<char> CopyString(std::string_view str) {
+        std::span<char> copy = AllocateArray<char>(str.size());
+        std::copy(str.begin(), str.end(), copy.begin());
+        return copy;
+    }
+
+    size_t BytesUsed() const { return bytesUsed; }
+    size_t BlockCount() const { return blocks.size(); }
+
+private:
+    std::vector<std::unique_ptr<Byte[]>> blocks;
+    Byte* cursor = nullptr;
+    Byte* end = nullptr;
+    size_t bytesUsed = 0;
+};
+//Macro defined in the source with ".define name body" or ".define name(a, b) body"
+struct AsmMacro {
+    bool function; //Takes arguments, only expanded where it is called inside an expression
+    std::vector<std::string_view> params;
+    std::string_view body; //View into the arena
+};
+//Interns label names so the IR can refer to labels by a 16 bit id instead of by string
+//Operand expressions that use labels get a symbol too, their value is computed instead of looked up
+struct AsmSymbolTable {
+    static constexpr size_t MAX_SYMBOLS = 0xFFFF;
+    static constexpr DWord UNDEFINED = 0xFFFFFFFF; //Wider than an address, a label can be at 0xFFFF
+
+    std::unordered_map<std::string_view, Word> ids;
+    std::vector<std::string_view> names; //Views into the arena, indexed by id
+    std::vector<DWord> addresses; //Indexed by id, UNDEFINED until the label is encoded
+    std::vector<std::string_view> expressions; //Indexed by id, the text of expression symbols and empty for labels
+    std::unordered_map<std::string_view, AsmMacro> defines;
+
+    Word Intern(std::string_view name) {
+        auto [itr, inserted] = ids.try_emplace(name, static_cast<Word>(names.size()));
+        if (inserted) {
+            if (names.size() == MAX_SYMBOLS) {
+                throw Except("ERROR: Too many labels");
+            }
+            names.push_back(name);
+            addresses.push_back(UNDEFINED);
+            expressions.emplace_back();
+        }
+        return itr->second;
+    }
+    Word InternExpression(std::string_view text) {
+        Word id = Intern(text);
+        expressions[id] = text;
+        return id;
+    }
+};
+struct AsmArgument
+{
+    Type type;
+    Word value; //Constant, address or register index. Symbol id for labels
+    bool symbolic = false; //Type_Address of a label or label expression, value is its symbol id and it is patched like a label
+};
+struct AsmInstruction
+{
+    static constexpr size_t MAX_ARGS = 3; //No instruction takes more than 3 operands (e.g. jre reg value address)
+
+    Instruction inst;
+    Byte argCount;
+    AsmArgument args[MAX_ARGS];
+
+    std::span<const AsmArgument> Args() const {
+        return { args, argCount };
+    }
+};
+struct AsmFixup {
+    size_t index; //Index of the placeholder in progmem
+    Word symbol;
+};
+//Characters of a quoted .ascii operand, with the escapes \n \t \r \0 \\ and \"
+static std::string DecodeString(std::string_view str) {
+    if (str.size() < 2 || str.front() != '"' || str.back() != '"') {
+        throw Except(("ERROR: Expected a quoted string: " + std::string(str)).c_str());
+    }
+    std::string text;
+    for (size_t i = 1; i + 1 < str.size(); i++) {
+        if (str[i] != '\\') {
+            text += str[i];
+            continue;
+        }
+        switch (i + 2 < str.size() ? str[++i] : '\0')
+        {
+        case 'n': text += '\n'; break;
+        case 't': text += '\t'; break;
+        case 'r': text += '\r'; break;
+        case '0': text += '\0'; break;
+        case '\\': text += '\\'; break;
+        case '"': text += '"'; break;
+        default:
+            throw Except(("ERROR: Invalid escape in string: " + std::string(str)).c_str());
+        }
+    }
+    return text;
+}
+//Values of .byte and of .fill, negative constants are stored as two's complement
+static AsmArgument ToByteArgument(const AsmArgument& arg, std::string_view str) {
+    if (arg.type != Type_Word || (arg.value > 0xFF && arg.value < 0xFF80)) {
+        throw Except(("ERROR: Not a byte constant: " + std::string(str)).c_str());
+    }
+    return AsmArgument{ Type_Byte, static_cast<Word>(arg.value & 0xFF) };
+}
+struct AsmLabel {
+    std::string_view name;
+    Word symbol;
+    size_t firstToken; //Range into the shared token list
+    size_t lastToken;
+    std::span<AsmInstruction> instructions;
+    Word memAddress;
+
+    //Most IR entries the label needs. One per line, except directives which are split into entries of up to MAX_ARGS.
+    //Strings count one per character of the token, escapes make them a little shorter
+    size_t CountEntries(const std::vector<std::string_view>& tokens) const {
+        size_t entries = 0;
+        size_t lineArgs = 0;
+        bool isFirstWord = true;
+        bool isDirective = false;
+        bool isString = false;
+
+        for (size_t i = firstToken; i < lastToken; i++) {
+            if (tokens[i] == "\n") {
+                entries += isDirective ? std::max<size_t>(1, (lineArgs + AsmInstruction::MAX_ARGS - 1) / AsmInstruction::MAX_ARGS) : 1;
+                lineArgs = 0;
+                isFirstWord = true;
+                continue;
+            }
+
+            if (isFirstWord) {
+                isDirective = tokens[i].front() == '.';
+                isString = tokens[i] == ".ascii";
+            }
+            else {
+                lineArgs += isString ? tokens[i].size() : 1;
+            }
+            isFirstWord = false;
+        }
+        return entries;
+    }
+
+    void Parse(AsmArena& arena, AsmSymbolTable& symbols, const std::vector<std::string_view>& tokens, bool verbose) {
+        bool isFirstWord = true;
+        size_t instructionCount = 0;
+        AsmInstruction* asmInst = nullptr;
+
+        if (verbose) {
+            std::printf("Label: %.*s\n", static_cast<int>(name.size()), name.data());
+        }
+
+        instructions = arena.AllocateArray<AsmInstruction>(CountEntries(tokens));
+
+        auto addArgument = [&](AsmArgument arg) {
+            if (asmInst->argCount == AsmInstruction::MAX_ARGS) {
+                if (!IsDataList(asmInst->inst)) {
+                    throw Except("ERROR: Too many arguments for instruction");
+                }
+
+                //Long directives continue in the next entry
+                Instruction directive = asmInst->inst;
+                asmInst = &instructions[instructionCount++];
+                asmInst->inst = directive;
+            }
+            asmInst->args[asmInst->argCount++] = arg;
+        };
+
+        for (size_t i = firstToken; i < lastToken; i++)
+        {
+            std::string_view word = tokens[i];
+
+            if (word == "\n") {
+                if (verbose) {
+                    std::printf("\n");
+                }
+                CheckDirective(*asmInst);
+                isFirstWord = true;
+                continue;
+            }
+
+            if (verbose) {
+                std::printf("%.*s\n", static_cast<int>(word.size()), word.data());
+            }
+
+            if (isFirstWord) {
+                asmInst = &instructions[instructionCount++];
+                asmInst->inst = ParseAssemblyInstruction(word);
+            }
+            else if (asmInst->inst == INST_ASCII) {
+                for (char c : DecodeString(word)) {
+                    addArgument(AsmArgument{ Type_Byte, static_cast<Byte>(c) });
+                }
+            }
+            else {
+                AsmArgument arg = ParseArgument(word, symbols);
+                if (asmInst->inst == INST_BYTE || (asmInst->inst == INST_FILL && asmInst->argCount == 1)) {
+                    arg = ToByteArgument(arg, word);
+                }
+                addArgument(arg);
+            }
+
+            isFirstWord = false;
+        }
+        instructions = instructions.first(instructionCount);
+    }
+};
+
+//Built in macros, lower case since tokens are lowered before they are looked up
+const std::map<std::string, std::string, std::less<>> macros {
+    {"_wordbits", "16"},
+    {"_wordbytes", "2"},
+    {"_versionmajor", std::to_string(DISA_MAJOR)},
+    {"_versionminor", std::to_string(DISA_MINOR)},
+    {"_versionpatch", std::to_string(DISA_PATCH)},
+};
+const std::map<std::string, Instruction, std::less<>> instructionAliases {
+    //x86 style
+    { "noop", INST_NOOP},
+    { "reset", INST_RESET},
+    { "halt", INST_HALT},
+    { "add", INST_ADD},
+    { "sub", INST_SUB},
+    { "mul", INST_MUL},
+    { "div", INST_DIV},
+    { "inc", INST_INC},
+    { "dec", INST_DEC},
+    { "uxt", INST_UXT},
+    { "lsl", INST_LSL},
+    { "lsr", INST_LSR},
+    { "rol", INST_ROL},
+    { "ror", INST_ROR},
+    { "and", INST_AND},
+    { "or", INST_OR},
+    { "xor", INST_XOR},
+    { "not", INST_NOT},
+    { "mov", INST_MOV},
+    { "bmov", INST_BMOV},
+    { "bset", INST_BSET},
+    { "bcmp", INST_BCMP},
+    { "jsr", INST_JSR},
+    { "rtn", INST_RTN},
+    { "jmp", INST_JMP},
+    { "jrz", INST_JRZ},
+    { "jre", INST_JRE},
+    { "jrn", INST_JRN},
+    { "jrg", INST_JRG},
+    { "jrge", INST_JRGE},
+    { "jrl", INST_JRL},
+    { "jrle", INST_JRLE},
+    { "cmp", INST_CMP},
+    { "beq", INST_BEQ},
+    { "bne", INST_BNE},
+    { "blt", INST_BLT},
+    { "bge", INST_BGE},
+    { "bcs", INST_BCS},
+    { "bcc", INST_BCC},
+    { "bvs", INST_BVS},
+    { "bvc", INST_BVC},
+    { "push", INST_PUSH},
+    { "pop", INST_POP},
+    { "pushs", INST_PUSHS},
+    { "pops", INST_POPS},
+    { "sei", INST_SETI},
+    { "cli", INST_CLRI},
+    { "wait", INST_WAIT},
+    { "rdcyc", INST_RDCYC},
+    { "rdcych", INST_RDCYCH},
+    { "rdinst", INST_RDINST},
+    { "rdinsth", INST_RDINSTH},
+    { "rti", INST_RTI},
+
+    //Dan style
+    { "noop", INST_NOOP},
+    { "reset", INST_RESET},
+    { "halt", INST_HALT},
+    { "add", INST_ADD},
+    { "sub", INST_SUB},
+    { "mul", INST_MUL},
+    { "div", INST_DIV},
+    { "inc", INST_INC},
+    { "dec", INST_DEC},
+    { "extend", INST_UXT},
+    { "shiftl", INST_LSL},
+    { "shiftr", INST_LSR},
+    { "rotatel", INST_ROL},
+    { "rotater", INST_ROR},
+    { "bitand", INST_AND},
+    { "bitor", INST_OR},
+    { "bitxor", INST_XOR},
+    { "bitnot", INST_NOT},
+    { "move", INST_MOV},
+    { "blockmove", INST_BMOV},
+    { "blockfill", INST_BSET},
+    { "blockcompare", INST_BCMP},
+    { "jsr", INST_JSR},
+    { "return", INST_RTN},
+    { "jump", INST_JMP},
+    { "jzero", INST_JRZ},
+    { "jequal", INST_JRE},
+    { "jnequal", INST_JRN},
+    { "jrg", INST_JRG},
+    { "jrge", INST_JRGE},
+    { "jrl", INST_JRL},
+    { "jrle", INST_JRLE},
+    { "compare", INST_CMP},
+    { "bequal", INST_BEQ},
+    { "bnequal", INST_BNE},
+    { "bless", INST_BLT},
+    { "bgequal", INST_BGE},
+    { "bcarry", INST_BCS},
+    { "bncarry", INST_BCC},
+    { "boverflow", INST_BVS},
+    { "bnoverflow", INST_BVC},
+    { "push", INST_PUSH},
+    { "pop", INST_POP},
+    { "pushs", INST_PUSHS},
+    { "pops", INST_POPS},
+    { "seti", INST_SETI},
+    { "cleari", INST_CLRI},
+    { "waiti", INST_WAIT},
+    { "readcycles", INST_RDCYC},
+    { "readcyclesh", INST_RDCYCH},
+    { "readinstructions", INST_RDINST},
+    { "readinstructionsh", INST_RDINSTH},
+    { "returni", INST_RTI},
+
+    //Directives
+    { ".table", INST_TABLE},
+    { ".word", INST_TABLE},
+    { ".byte", INST_BYTE},
+    { ".ascii", INST_ASCII},
+    { ".fill", INST_FILL},
+    { ".align", INST_ALIGN},
+};
+
+static Word ParseNumber(std::string_view str, int base) {
+    Word value = 0;
+    auto [ptr, error] = std::from_chars(str.data(), str.data() + str.size(), value, base);
+    if (error != std::errc() || ptr != str.data() + str.size()) {
+        throw Except(("Invalid constant: " + std::string(str)).c_str());
+    }
+    return value;
+}
+static Word ParseConstant(std::string_view str) {
+    if (str.substr(0, 2) == "0x") {
+        return ParseNumber(str.substr(2), 16);
+    }
+    return ParseNumber(str, 10);
+}
+static Byte GetRegisterByName(std::string_view name) {
+    if (name.size() > 1 && std::isdigit(name[1])) {
+        return (Byte)ParseNumber(name.substr(1), 10);
+    }
+    else {
+        if (name == "rpc") {
+            return (Byte)6;
+        }
+        else if (name == "rsp") {
+            return (Byte)7;
+        }
+    }
+    throw Except("Invalid register name");
+}
+static bool IsBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+static bool IsRegisterName(std::string_view name) {
+    if (name == "rpc" || name == "rsp") {
+        return true;
+    }
+    return name.size() > 1 && name.front() == 'r' && std::all_of(name.begin() + 1, name.end(), [](unsigned char c) { return std::isdigit(c); });
+}
+static bool IsIdentifierChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+}
+static bool IsIdentifier(std::string_view str) {
+    return !str.empty() && !std::isdigit(static_cast<unsigned char>(str.front())) && std::all_of(str.begin(), str.end(), IsIdentifierChar);
+}
+
+//Constant expression in an operand, e.g. "(table + _WordBytes * 4)" or "[0x4000 + offset(3)]"
+//  - Numbers, labels, macros, macro calls and parentheses with the C operators - ~ * / % + - << >> & ^ | and their precedence
+//  - Computed with 64 bit integers, the result is truncated to a Word
+//  - lookup gives the address of a label, or nothing while the labels are not laid out yet. The result is then a placeholder
+//    and the expression is evaluated again once every label has an address
+struct AsmExpression {
+    using Lookup = std::function<std::optional<Word>(std::string_view name)>;
+    using Params = std::unordered_map<std::string_view, i64>;
+    static constexpr int MAX_DEPTH = 32; //Nested macro expansions, stops macros that expand into themselves
+
+    //False when a label was not known and value is a placeholder
+    static bool Evaluate(std::string_view text, const AsmSymbolTable& symbols, const Lookup& lookup, Word& value) {
+        AsmExpression expression{ text, symbols, lookup };
+        value = static_cast<Word>(expression.ParseAll());
+        return !expression.placeholder;
+    }
+
+private:
+    AsmExpression(std::string_view text, const AsmSymbolTable& symbols, const Lookup& lookup, const Params* params = nullptr, int depth = 0)
+        : text(text), symbols(symbols), lookup(lookup), params(params), depth(depth) {}
+
+    std::string_view text;
+    const AsmSymbolTable& symbols;
+    const Lookup& lookup;
+    const Params* params; //Arguments of the macro being expanded
+    int depth;
+    size_t pos = 0;
+    bool placeholder = false;
+
+    [[noreturn]] void Fail(const char* reason) const {
+        throw Except(("ERROR: " + std::string(reason) + " in expression: " + std::string(text)).c_str());
+    }
+    char Peek() {
+        while (pos < text.size() && IsBlank(text[pos])) {
+            pos++;
+        }
+        return pos < text.size() ? text[pos] : '\0';
+    }
+    bool Accept(std::string_view op) {
+        Peek();
+        if (text.substr(pos, op.size()) != op) {
+            return false;
+        }
+        pos += op.size();
+        return true;
+    }
+
+    i64 ParseAll() {
+        i64 value = ParseOr();
+        if (Peek() != '\0') {
+            Fail("Unexpected character");
+        }
+        return value;
+    }
+    i64 ParseOr() {
+        i64 value = ParseXor();
+        while (Accept("|")) {
+            value |= ParseXor();
+        }
+        return value;
+    }
+    i64 ParseXor() {
+        i64 value = ParseAnd();
+        while (Accept("^")) {
+            value ^= ParseAnd();
+        }
+        return value;
+    }
+    i64 ParseAnd() {
+        i64 value = ParseShift();
+        while (Accept("&")) {
+            value &= ParseShift();
+        }
+        return value;
+    }
+    i64 ParseShift() {
+        i64 value = ParseSum();
+        while (true) {
+            if (Accept("<<")) {
+                i64 amount = ParseSum();
+                value = amount < 0 || amount > 63 ? 0 : static_cast<i64>(static_cast<uint64_t>(value) << amount);
+            }
+            else if (Accept(">>")) {
+                i64 amount = ParseSum();
+                value = amount < 0 || amount > 63 ? 0 : value >> amount;
+            }
+            else {
+                return value;
+            }
+        }
+    }
+    i64 ParseSum() {
+        i64 value = ParseProduct();
+        while (true) {
+            if (Accept("+")) {
+                value += ParseProduct();
+            }
+            else if (Accept("-")) {
+                value -= ParseProduct();
+            }
+            else {
+                return value;
+            }
+        }
+    }
+    i64 ParseProduct() {
+        i64 value = ParseUnary();
+        while (true) {
+            bool divide = false;
+            if (Accept("*")) {
+                value *= ParseUnary();
+                continue;
+            }
+            else if (Accept("/")) {
+                divide = true;
+            }
+            else if (!Accept("%")) {
+                return value;
+            }
+            i64 divisor = ParseUnary();
+            if (divisor == 0) {
+                if (!placeholder) {
+                    Fail("Division by zero");
+                }
+                value = 0; //Placeholder labels are 0, the real values are checked later
+                continue;
+            }
+            value = divide ? value / divisor : value % divisor;
+        }
+    }
+    i64 ParseUnary() {
+        if (Accept("-")) {
+            return -ParseUnary();
+        }
+        if (Accept("~")) {
+            return ~ParseUnary();
+        }
+        if (Accept("+")) {
+            return ParseUnary();
+        }
+        return ParsePrimary();
+    }
+    i64 ParsePrimary() {
+        char c = Peek();
+        if (c == '(') {
+            pos++;
+            i64 value = ParseOr();
+            if (!Accept(")")) {
+                Fail("Missing )");
+            }
+            return value;
+        }
+
+        size_t start = pos;
+        while (pos < text.size() && IsIdentifierChar(text[pos])) {
+            pos++;
+        }
+        std::string_view word = text.substr(start, pos - start);
+        if (word.empty()) {
+            Fail("Expected a value");
+        }
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            return ParseConstant(word);
+        }
+        if (Peek() == '(') {
+            return ParseCall(word);
+        }
+        if (params != nullptr) {
+            auto param = params->find(word);
+            if (param != params->end()) {
+                return param->second;
+            }
+        }
+        auto define = symbols.defines.find(word);
+        if (define != symbols.defines.end()) {
+            if (define->second.function) {
+                Fail("Macro needs arguments");
+            }
+            return Expand(define->second, nullptr);
+        }
+        auto macro = macros.find(word);
+        if (macro != macros.end()) {
+            return ParseConstant(macro->second);
+        }
+        if (IsRegisterName(word)) {
+            Fail("Registers cannot be used");
+        }
+
+        std::optional<Word> address = lookup(word);
+        if (!address) {
+            placeholder = true;
+            return 0;
+        }
+        return *address;
+    }
+    //Arguments are evaluated before they are bound to the parameters
+    i64 ParseCall(std::string_view name) {
+        auto define = symbols.defines.find(name);
+        if (define == symbols.defines.end() || !define->second.function) {
+            Fail("Unknown macro");
+        }
+        const AsmMacro& macro = define->second;
+
+        Params args;
+        Accept("(");
+        if (!Accept(")")) {
+            do {
+                if (args.size() == macro.params.size()) {
+                    Fail("Too many macro arguments");
+                }
+                args[macro.params[args.size()]] = ParseOr();
+            } while (Accept(","));
+            if (!Accept(")")) {
+                Fail("Missing )");
+            }
+        }
+        if (args.size() != macro.params.size()) {
+            Fail("Too few macro arguments");
+        }
+        return Expand(macro, &args);
+    }
+    i64 Expand(const AsmMacro& macro, const Params* args) {
+        if (depth == MAX_DEPTH) {
+            Fail("Macros nested too deep");
+        }
+        AsmExpression body{ macro.body, symbols, lookup, args, depth + 1 };
+        i64 value = body.ParseAll();
+        placeholder |= body.placeholder;
+        return value;
+    }
+};
+
+static Type GetVarType(std::string_view str) {
+    if (str.front() == '[' && str.back() == ']') { //Address
+        if (IsRegisterName(str.substr(1, str.length() - 2))) {
+            return Type_AddressRegister; //Address must be read from a register
+        }
+        else {
+            return Type_Address; //Constant, or an expression of constants
+        }
+    }
+    else if (IsRegisterName(str)) {
+        return Type_Register;
+    }
+    else if (str.substr(0, 2) == "0x") {
+        return Type_Word;
+    }
+    else if (isdigit(str.front())) {
+        return Type_Word;
+    }
+    else {
+        return Type_Label;
+    }
+}
+static Word GetVarValue(std::string_view str, Type type, AsmSymbolTable& symbols) {
+    switch (type)
+    {
+    case Type_Word:
+        return ParseConstant(str);
+    case Type_Address:
+        return ParseConstant(str.substr(1, str.length() - 2)); //Should be the constant portion
+    case Type_AddressRegister:
+        return GetRegisterByName(str.substr(1, str.length() - 2)); //Should be the register name portion
+    case Type_Register: {
+        return GetRegisterByName(str);
+    }
+    case Type_Label:
+        return symbols.Intern(str);
+    default:
+        throw;
+    }
+}
+//Operands that are not a plain constant, register or label are expressions. Expressions of constants are folded here,
+//ones that use labels become a label operand with a symbol of their own, or a symbolic address inside [ ]
+static AsmArgument ParseArgument(std::string_view str, AsmSymbolTable& symbols) {
+    Type type = GetVarType(str);
+    std::string_view text = type == Type_Address ? str.substr(1, str.length() - 2) : str;
+    bool isNumber = !text.empty() && std::isdigit(static_cast<unsigned char>(text.front())) && std::all_of(text.begin(), text.end(), IsIdentifierChar);
+    bool isExpression = type == Type_Label ? !IsIdentifier(text) : (type == Type_Word || type == Type_Address) && !isNumber;
+    if (!isExpression) {
+        return AsmArgument{ type, GetVarValue(str, type, symbols) };
+    }
+
+    Word value;
+    bool constant = AsmExpression::Evaluate(text, symbols, [](std::string_view) -> std::optional<Word> { return std::nullopt; }, value);
+    if (constant) {
+        return AsmArgument{ type == Type_Address ? Type_Address : Type_Word, value };
+    }
+    if (type == Type_Address) {
+        return AsmArgument{ Type_Address, IsIdentifier(text) ? symbols.Intern(text) : symbols.InternExpression(text), true };
+    }
+    return AsmArgument{ Type_Label, symbols.InternExpression(text) };
+}
+static Opcode GetOpcode(const AsmInstruction& asmInst) {
+    switch (asmInst.inst)
+    {
+    case INST_NOOP:
+        return OP_NOOP;
+    case INST_RESET:
+        return OP_RESET;
+    case INST_HALT:
+        return OP_HALT;
+    case INST_ADD:
+        switch (asmInst.args[1].type)
+        {
+        case Type_Word:
+        case Type_Label:
+            return OP_ADDC;
+        case Type_Byte:
+            return OP_ADDCB;
+        case Type_Register:
+            return OP_ADD;
+        }
+        break;
+    case INST_SUB:
+        switch (asmInst.args[1].type)
+        {
+        case Type_Word:
+        case Type_Label:
+            return OP_SUBC;
+        case Type_Byte:
+            return OP_SUBCB;
+        case Type_Register:
+            return OP_SUB;
+        }
+        break;
+    case INST_MUL:
+        switch (asmInst.args[1].type)
+        {
+        case Type_Word:
+            return OP_MULC;
+        case Type_Register:
+            return OP_MUL;
+        }
+        break;
+    case INST_DIV:
+        switch (asmInst.args[1].type)
+        {
+        case Type_Word:
+            return OP_DIVC;
+        case Type_Register:
+            return OP_DIV;
+        }
+        break;
+    case INST_CMP:
+        switch (asmInst.args[1].type)
+        {
+        case Type_Word:
+        case Type_Label:
+            return OP_CMPC;
+        case Type_Byte:
+            return OP_CMPCB;
+        case Type_Register:
+            return OP_CMP;
+        case Type_Address:
+            return OP_CMPA;
+        case Type_AddressRegister:
+            return (Opcode)(OP_CMPA | 0x80);
+        }
+        break;
+    case INST_INC:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Register:
+            return OP_INC;
+        }
+        break;
+    case INST_DEC:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Register:
+            return OP_DEC;
+        }
+        break;
+    case INST_UXT:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Register:
+            return OP_UXT;
+        default:
+            break;
+        }
+        break;
+    case INST_LSL:
+    case INST_LSR:
+    case INST_ROL:
+    case INST_ROR:
+    case INST_AND:
+    case INST_OR:
+    case INST_XOR: {
+        //Register/constant and register/register forms are adjacent opcodes
+        Opcode constantOpcode = OP_LSL;
+        Opcode registerOpcode = OP_LSLR;
+        switch (asmInst.inst)
+        {
+        case INST_LSR: constantOpcode = OP_LSR; registerOpcode = OP_LSRR; break;
+        case INST_ROL: constantOpcode = OP_ROL; registerOpcode = OP_ROLR; break;
+        case INST_ROR: constantOpcode = OP_ROR; registerOpcode = OP_RORR; break;
+        case INST_AND: constantOpcode = OP_ANDC; registerOpcode = OP_AND; break;
+        case INST_OR: constantOpcode = OP_ORC; registerOpcode = OP_OR; break;
+        case INST_XOR: constantOpcode = OP_XORC; registerOpcode = OP_XOR; break;
+        default: break;
+        }
+
+        if (asmInst.args[0].type == Type_Register) {
+            switch (asmInst.args[1].type)
+            {
+            case Type_Word:
+            case Type_Label:
+                return constantOpcode;
+            case Type_Register:
+                return registerOpcode;
+            }
+        }
+        break;
+    }
+    case INST_NOT:
+        if (asmInst.args[0].type == Type_Register) {
+            return OP_NOT;
+        }
+        break;
+    case INST_MOV:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Register: {
+            switch (asmInst.args[1].type)
+            {
+            case Type_Word:
+            case Type_Label:
+                return OP_LDC;
+            case Type_Byte:
+                return OP_LDCB;
+            case Type_Address:
+                return OP_LDM;
+            case Type_AddressRegister:
+                return (Opcode)(OP_LDM | 0x80);
+            case Type_Register:
+                return OP_LDR;
+            }
+        } break;
+        case Type_Address: {
+            switch (asmInst.args[1].type)
+            {
+            case Type_Word:
+            case Type_Label:
+                return OP_STCM;
+            case Type_Address:
+            case Type_AddressRegister:
+                throw Except("Cannot move memory into memory");
+            case Type_Register:
+                return OP_STRM;
+            }
+        } break;
+        case Type_AddressRegister: {
+            switch (asmInst.args[1].type)
+            {
+            case Type_Word:
+            case Type_Label:
+                return (Opcode)(OP_STCM | 0x80);
+            case Type_Address:
+            case Type_AddressRegister:
+                throw Except("Cannot move memory into memory");
+            case Type_Register:
+                return (Opcode)(OP_STRM | 0x80);
+            }
+        } break;
+        }
+        throw Except("Cannot move a value into constant or program memory");
+    case INST_BMOV:
+    case INST_BSET:
+    case INST_BCMP:
+        if (asmInst.argCount != 3 || asmInst.args[0].type != Type_Register || asmInst.args[1].type != Type_Register || asmInst.args[2].type != Type_Register) {
+            throw Except("Block instructions take 3 registers");
+        }
+        return asmInst.inst == INST_BMOV ? OP_BMOV : asmInst.inst == INST_BSET ? OP_BSET : OP_BCMP;
+    case INST_JSR:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Register:
+            return (Opcode)(OP_JSR | 0x80);
+        case Type_Address:
+            return OP_JSRI;
+        case Type_AddressRegister:
+            return (Opcode)(OP_JSRI | 0x80);
+        default:
+            return OP_JSR;
+        }
+    case INST_RTN:
+        return OP_RTN;
+    case INST_JMP:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Relative:
+            return OP_JMPS;
+        case Type_Register:
+            return (Opcode)(OP_JMP | 0x80);
+        case Type_Address:
+            return OP_JMPI;
+        case Type_AddressRegister:
+            return (Opcode)(OP_JMPI | 0x80);
+        default:
+            return OP_JMP;
+        }
+    case INST_JRZ:
+    case INST_JRE:
+    case INST_JRN:
+    case INST_JRG:
+    case INST_JRGE:
+    case INST_JRL:
+    case INST_JRLE: {
+        Opcode opcode = OP_JRZ;
+        Opcode shortOpcode = OP_JRZS;
+        switch (asmInst.inst)
+        {
+        case INST_JRE: opcode = OP_JRE; shortOpcode = OP_JRES; break;
+        case INST_JRN: opcode = OP_JRN; shortOpcode = OP_JRNS; break;
+        case INST_JRG: opcode = OP_JRG; shortOpcode = OP_JRGS; break;
+        case INST_JRGE: opcode = OP_JRGE; shortOpcode = OP_JRGES; break;
+        case INST_JRL: opcode = OP_JRL; shortOpcode = OP_JRLS; break;
+        case INST_JRLE: opcode = OP_JRLE; shortOpcode = OP_JRLES; break;
+        default: break;
+        }
+
+        switch (asmInst.args[asmInst.argCount - 1].type)
+        {
+        case Type_Relative:
+            return shortOpcode;
+        case Type_Register:
+            return (Opcode)(opcode | 0x80);
+        case Type_Word:
+        case Type_Label:
+            return opcode;
+        default:
+            throw Except("Conditional jumps cannot jump through memory, load the address into a register first");
+        }
+    }
+    case INST_BEQ:
+    case INST_BNE:
+    case INST_BLT:
+    case INST_BGE:
+    case INST_BCS:
+    case INST_BCC:
+    case INST_BVS:
+    case INST_BVC:
+        if (asmInst.args[0].type != Type_Relative && asmInst.args[0].type != Type_Label) {
+            throw Except("Flag branches can only target a label");
+        }
+        switch (asmInst.inst)
+        {
+        case INST_BEQ: return OP_BEQ;
+        case INST_BNE: return OP_BNE;
+        case INST_BLT: return OP_BLT;
+        case INST_BGE: return OP_BGE;
+        case INST_BCS: return OP_BCS;
+        case INST_BCC: return OP_BCC;
+        case INST_BVS: return OP_BVS;
+        default: return OP_BVC;
+        }
+    case INST_PUSH:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Word:
+        case Type_Label:
+            return OP_PUSHC;
+        case Type_Byte:
+            return OP_PUSHCB;
+        case Type_Register:
+            return OP_PUSH;
+        }
+        break;
+    case INST_POP:
+        switch (asmInst.args[0].type)
+        {
+        case Type_Word:
+        case Type_Register:
+            return OP_POP;
+        }
+        break;
+    case INST_PUSHS:
+        return OP_PUSHS;
+    case INST_POPS:
+        return OP_POPS;
+    case INST_SETI:
+        return OP_SEI;
+    case INST_CLRI:
+        return OP_CLI;
+    case INST_WAIT:
+        return OP_WAIT;
+    case INST_RTI:
+        return OP_RTI;
+    case INST_RDCYC:
+    case INST_RDCYCH:
+    case INST_RDINST:
+    case INST_RDINSTH:
+        if (asmInst.argCount != 2 || asmInst.args[0].type != Type_Register || asmInst.args[1].type != Type_Register) {
+            break;
+        }
+        return (Opcode)(OP_RDCYC + (asmInst.inst - INST_RDCYC));
+    default:
+        break;
+    }
+    throw Except("ERROR: No matching opcode found for instruction");
+}
+static Instruction ParseAssemblyInstruction(std::string_view str) {
+    auto itr = instructionAliases.find(str);
+    if (itr != instructionAliases.end()) {
+        return itr->second;
+    }
+    throw Except("ERROR: Invalid assembly instruction");
+}
+static Word GetLabelValue(Word symbol, const AsmSymbolTable& symbols) {
+    if (symbols.addresses[symbol] != AsmSymbolTable::UNDEFINED) {
+        return static_cast<Word>(symbols.addresses[symbol]);
+    }
+    if (!symbols.expressions[symbol].empty()) {
+        Word value;
+        AsmExpression::Evaluate(symbols.expressions[symbol], symbols, [&](std::string_view name) -> std::optional<Word> {
+            auto id = symbols.ids.find(name);
+            if (id == symbols.ids.end()) {
+                throw Except(("Label does not exist: " + std::string(name)).c_str());
+            }
+            return GetLabelValue(id->second, symbols);
+        }, value);
+        return value;
+    }
+    throw Except(("Label does not exist: " + std::string(symbols.names[symbol])).c_str());
+}
+
+//Execution counts of an earlier run, per label. Lines are "<label> <count>" or "<0xADDR> <count>", addresses are attributed
+//to labels with the symbols of the build that was profiled (Profiler::SaveCounts writes the address form)
+struct AsmProfile {
+    std::map<std::string, uint64_t, std::less<>> counts;
+
+    bool Load(const std::string& filename, const SymbolMap& symbols) {
+        std::ifstream infile(filename);
+        std::string key;
+        uint64_t count;
+        while (infile >> key >> count) {
+            if (key.substr(0, 2) == "0x") {
+                auto label = symbols.Find(static_cast<Word>(std::stoul(key, nullptr, 16)));
+                if (label != nullptr) {
+                    counts[label->second] += count;
+                }
+            }
+            else {
+                counts[key] += count;
+            }
+        }
+        return !counts.empty();
+    }
+    uint64_t Count(std::string_view label) const {
+        auto itr = counts.find(label);
+        return itr != counts.end() ? itr->second : 0;
+    }
+};
+
+struct AsmOptions {
+    bool optimize = false; //Run the peephole optimizer between parsing and encoding
+    bool verbose = true; //Print every token and the optimizer and relaxation statistics
+    const AsmProfile* profile = nullptr; //Optional, owned by the caller. Lays the labels out by execution counts
+};
+struct AsmOptimizerStats {
+    size_t removed = 0; //Identities, self moves, dead loads and jumps to the next label
+    size_t rewritten = 0; //Instructions replaced by a shorter or cheaper equivalent
+    size_t threaded = 0; //Jumps retargeted past labels that only jump elsewhere
+    size_t bytesSaved = 0; //CPU::Execute charges one cycle per fetched byte
+};
+struct AsmLayoutStats {
+    size_t chains = 0; //Runs of labels that fall through into each other, the units that are moved
+    size_t dropped = 0; //Labels no reachable code refers to
+    size_t fallThroughs = 0; //Jumps removed because their target was placed right after them
+};
+
+//Encoded size of an operand in bytes
+static Word GetArgumentSize(const AsmArgument& arg) {
+    switch (arg.type)
+    {
+    case Type_Register:
+    case Type_AddressRegister:
+    case Type_Byte:
+    case Type_Relative:
+        return 1;
+    default:
+        return 2;
+    }
+}
+static bool IsDirective(Instruction inst) {
+    return inst >= INST_TABLE && inst <= INST_ALIGN;
+}
+//Directives that take any number of operands
+static bool IsDataList(Instruction inst) {
+    return inst == INST_TABLE || inst == INST_BYTE || inst == INST_ASCII;
+}
+static bool IsFlagBranch(const AsmInstruction& asmInst) {
+    return asmInst.inst >= INST_BEQ && asmInst.inst <= INST_BVC;
+}
+//Encoded size at address, only alignment depends on the address
+static Word GetInstructionSize(const AsmInstruction& asmInst, Word address) {
+    if (IsFlagBranch(asmInst) && asmInst.args[0].type == Type_Label) {
+        return 5; //Out of range flag branches become an inverted short branch over a JMP
+    }
+    if (asmInst.inst == INST_FILL) {
+        return asmInst.args[0].value;
+    }
+    if (asmInst.inst == INST_ALIGN) {
+        return static_cast<Word>(-address & (asmInst.args[0].value - 1));
+    }
+
+    Word size = IsDirective(asmInst.inst) ? 0 : 1; //Opcode
+    for (auto& arg : asmInst.Args()) {
+        size += GetArgumentSize(arg);
+    }
+    return size;
+}
+static bool IsConstant(const AsmArgument& arg, Word value) {
+    return arg.type == Type_Word && arg.value == value;
+}
+static bool IsPowerOfTwo(Word value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+static void CheckDirective(const AsmInstruction& asmInst) {
+    if (asmInst.inst == INST_FILL && (asmInst.argCount == 0 || asmInst.argCount > 2 || asmInst.args[0].type != Type_Word)) {
+        throw Except("ERROR: .fill takes a constant count and an optional byte value");
+    }
+    if (asmInst.inst == INST_ALIGN && (asmInst.argCount != 1 || asmInst.args[0].type != Type_Word || !IsPowerOfTwo(asmInst.args[0].value))) {
+        throw Except("ERROR: .align takes a constant power of two");
+    }
+}
+static bool ReadsStatusFlags(const AsmInstruction& asmInst) {
+    return asmInst.inst == INST_PUSHS || IsFlagBranch(asmInst);
+}
+//Instructions that set every status flag whatever their operands, BCMP is left out because it can stop at the cycle budget
+static bool WritesStatusFlags(const AsmInstruction& asmInst) {
+    switch (asmInst.inst)
+    {
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_CMP:
+    case INST_AND:
+    case INST_OR:
+    case INST_XOR:
+    case INST_NOT:
+    case INST_POPS:
+        return true;
+    default:
+        return false;
+    }
+}
+//Whether the status flags left by instructions[n] can still be read. Scans forward until an instruction overwrites them all.
+//Anything that can leave the straight line code (jumps, calls, returns, halting, data, the end of the label) counts as a read
+static bool StatusFlagsLive(std::span<const AsmInstruction> instructions, size_t n) {
+    for (size_t i = n + 1; i < instructions.size(); i++) {
+        const AsmInstruction& asmInst = instructions[i];
+        if (ReadsStatusFlags(asmInst)) {
+            return true;
+        }
+        if (WritesStatusFlags(asmInst)) {
+            return false;
+        }
+        switch (asmInst.inst)
+        {
+        case INST_NOOP:
+        case INST_INC:
+        case INST_DEC:
+        case INST_UXT:
+        case INST_LSL:
+        case INST_LSR:
+        case INST_ROL:
+        case INST_ROR:
+        case INST_BMOV:
+        case INST_BSET:
+        case INST_PUSH:
+        case INST_POP:
+        case INST_SETI:
+        case INST_CLRI:
+        case INST_RDCYC:
+        case INST_RDCYCH:
+        case INST_RDINST:
+        case INST_RDINSTH:
+            break;
+        case INST_MOV:
+            if (asmInst.args[0].type == Type_Register && asmInst.args[0].value == 6) {
+                return true; //Load into PC, a jump
+            }
+            break;
+        default:
+            return true;
+        }
+    }
+    return true;
+}
+static bool IsLabelJump(const AsmInstruction& asmInst) {
+    switch (asmInst.inst)
+    {
+    case INST_JSR:
+    case INST_JMP:
+    case INST_JRZ:
+    case INST_JRE:
+    case INST_JRN:
+    case INST_JRG:
+    case INST_JRGE:
+    case INST_JRL:
+    case INST_JRLE:
+    case INST_BEQ:
+    case INST_BNE:
+    case INST_BLT:
+    case INST_BGE:
+    case INST_BCS:
+    case INST_BCC:
+    case INST_BVS:
+    case INST_BVC:
+        return asmInst.argCount > 0 && asmInst.args[asmInst.argCount - 1].type == Type_Label;
+    default:
+        return false;
+    }
+}
+
+//Peephole pass over the parsed labels, run after .main has been moved to the front so the final layout is known
+//Arithmetic rewrites drop the status flag update of ADDC/MULC etc. so they are skipped unless StatusFlagsLive proves the flags dead.
+//Loads into PC are jumps and are never removed
+static AsmOptimizerStats OptimizeAssembly(std::vector<AsmLabel>& labels, const AsmSymbolTable& symbols) {
+    AsmOptimizerStats stats;
+    size_t sizeBefore = 0;
+    size_t sizeAfter = 0;
+
+    std::vector<AsmLabel*> labelBySymbol(symbols.names.size(), nullptr);
+    for (auto& label : labels) {
+        labelBySymbol[label.symbol] = &label;
+        for (auto& i : label.instructions) {
+            sizeBefore += GetInstructionSize(i, 0); //Alignment padding is not counted, the addresses are not known yet
+        }
+    }
+
+    //Thread jumps to jumps
+    for (auto& label : labels) {
+        for (auto& i : label.instructions) {
+            if (!IsLabelJump(i)) {
+                continue;
+            }
+
+            AsmArgument& target = i.args[i.argCount - 1];
+            Word originalTarget = target.value;
+            for (size_t hops = 0; hops < labels.size(); hops++) { //Bounded so jump cycles terminate
+                AsmLabel* targetLabel = labelBySymbol[target.value];
+                if (targetLabel == nullptr || targetLabel->instructions.empty()) {
+                    break;
+                }
+
+                const AsmInstruction& first = targetLabel->instructions.front();
+                if (first.inst != INST_JMP || first.args[0].type != Type_Label) {
+                    break;
+                }
+                target.value = first.args[0].value;
+            }
+
+            if (target.value != originalTarget) {
+                stats.threaded++;
+            }
+        }
+    }
+
+    //Local rewrites, instructions are compacted in place inside the label's arena array
+    for (size_t l = 0; l < labels.size(); l++) {
+        std::span<AsmInstruction> instructions = labels[l].instructions;
+        size_t count = 0;
+
+        for (size_t n = 0; n < instructions.size(); n++) {
+            AsmInstruction i = instructions[n];
+            const AsmInstruction* next = n + 1 < instructions.size() ? &instructions[n + 1] : nullptr;
+            auto flagsLive = [&] { return StatusFlagsLive(instructions, n); }; //Only scanned for the candidates
+            bool remove = false;
+
+            switch (i.inst)
+            {
+            case INST_MOV:
+                if (i.args[0].type == Type_Register && i.args[0].value == 6) {
+                    break; //Load into PC
+                }
+                if (i.args[0].type == Type_Register && i.args[1].type == Type_Register && i.args[0].value == i.args[1].value) {
+                    remove = true; //mov rX rX
+                }
+                else if (i.args[0].type == Type_Register && (i.args[1].type == Type_Word || i.args[1].type == Type_Register)
+                    && next != nullptr && next->inst == INST_MOV
+                    && next->args[0].type == Type_Register && next->args[0].value == i.args[0].value
+                    && !((next->args[1].type == Type_Register || next->args[1].type == Type_AddressRegister) && next->args[1].value == i.args[0].value)) {
+                    remove = true; //Dead load, overwritten by the next move without being read
+                }
+                break;
+            case INST_ADD:
+            case INST_SUB:
+                if ((i.args[0].type == Type_Register && i.args[0].value == 6) || flagsLive()) {
+                    break; //Arithmetic on PC is a jump
+                }
+                if (IsConstant(i.args[1], 0)) {
+                    remove = true;
+                }
+                else if (IsConstant(i.args[1], 1)) {
+                    i = AsmInstruction{ i.inst == INST_ADD ? INST_INC : INST_DEC, 1, { i.args[0] } };
+                    stats.rewritten++;
+                }
+                break;
+            case INST_MUL:
+            case INST_DIV:
+                if (i.args[1].type != Type_Word || (i.args[0].type == Type_Register && i.args[0].value == 6) || flagsLive()) {
+                    break;
+                }
+                if (i.args[1].value == 1) {
+                    remove = true;
+                }
+                else if (IsPowerOfTwo(i.args[1].value)) {
+                    Word shift = static_cast<Word>(std::countr_zero(i.args[1].value));
+                    i = AsmInstruction{ i.inst == INST_MUL ? INST_LSL : INST_LSR, 2, { i.args[0], AsmArgument{ Type_Word, shift } } };
+                    stats.rewritten++;
+                }
+                break;
+            case INST_AND:
+                if (IsConstant(i.args[1], 0xFF) && !(i.args[0].type == Type_Register && i.args[0].value == 6) && !flagsLive()) {
+                    i = AsmInstruction{ INST_UXT, 1, { i.args[0] } };
+                    stats.rewritten++;
+                }
+                break;
+            case INST_JRE:
+            case INST_JRLE:
+            case INST_JRL:
+                //Unsigned compares against 0 (or < 1) only pass on zero, JRZ does not encode the constant
+                if (IsConstant(i.args[1], i.inst == INST_JRL ? 1 : 0)) {
+                    i = AsmInstruction{ INST_JRZ, 2, { i.args[0], i.args[2] } };
+                    stats.rewritten++;
+                }
+                break;
+            case INST_JMP:
+                if (n + 1 == instructions.size() && l + 1 < labels.size()
+                    && i.args[0].type == Type_Label && i.args[0].value == labels[l + 1].symbol) {
+                    remove = true; //Falls through to the target anyway
+                }
+                break;
+            default:
+                break;
+            }
+
+            if (remove) {
+                stats.removed++;
+                continue;
+            }
+            instructions[count++] = i;
+            sizeAfter += GetInstructionSize(i, 0);
+        }
+
+        labels[l].instructions = instructions.first(count);
+    }
+
+    stats.bytesSaved = sizeBefore - sizeAfter;
+    return stats;
+}
+
+//Constants of add/sub/mov/push that fit in a byte use the short form opcodes
+//Last instruction never continues into the next label
+static bool EndsControlFlow(const AsmLabel& label) {
+    if (label.instructions.empty()) {
+        return false;
+    }
+    Instruction last = label.instructions.back().inst;
+    return last == INST_JMP || last == INST_RTN || last == INST_RTI || last == INST_HALT || last == INST_RESET;
+}
+//Profile guided layout, run before the optimizer so it sees the final order
+//  - Labels that cannot be reached from .main by falling through or through a label operand are dropped
+//  - Labels that fall through into each other form chains that are never split. Chains are joined along the hottest jumps
+//    and calls first (Pettis-Hansen), so a jump to the head of another chain becomes a fall-through and hot subroutines end
+//    up next to their callers. The joined chains follow .main from hottest to coldest
+static AsmLayoutStats ReorderLabels(std::vector<AsmLabel>& labels, const AsmSymbolTable& symbols, const AsmProfile& profile) {
+    AsmLayoutStats stats;
+    std::vector<size_t> labelBySymbol(symbols.names.size(), SIZE_MAX);
+    for (size_t l = 0; l < labels.size(); l++) {
+        labelBySymbol[labels[l].symbol] = l;
+    }
+
+    //Reachability from .main
+    std::vector<bool> reachable(labels.size(), false);
+    std::vector<size_t> work{ 0 };
+    reachable[0] = true;
+    auto reach = [&](size_t l) {
+        if (l < labels.size() && !reachable[l]) {
+            reachable[l] = true;
+            work.push_back(l);
+        }
+    };
+    while (!work.empty()) {
+        size_t l = work.back();
+        work.pop_back();
+        for (auto& i : labels[l].instructions) {
+            for (auto& arg : i.Args()) {
+                if (arg.type != Type_Label && !arg.symbolic) {
+                    continue;
+                }
+                reach(labelBySymbol[arg.value]);
+
+                //Labels used in an expression
+                if (!symbols.expressions[arg.value].empty()) {
+                    Word value;
+                    AsmExpression::Evaluate(symbols.expressions[arg.value], symbols, [&](std::string_view name) -> std::optional<Word> {
+                        auto id = symbols.ids.find(name);
+                        if (id != symbols.ids.end()) {
+                            reach(labelBySymbol[id->second]);
+                        }
+                        return std::nullopt;
+                    }, value);
+                }
+            }
+        }
+        if (!EndsControlFlow(labels[l])) {
+            reach(l + 1);
+        }
+    }
+
+    //Fall-through chains, an unreachable label is never fallen into from a reachable one
+    std::vector<std::vector<size_t>> chains;
+    std::vector<size_t> chainOf(labels.size(), SIZE_MAX);
+    for (size_t l = 0; l < labels.size(); l++) {
+        if (!reachable[l]) {
+            stats.dropped++;
+            continue;
+        }
+        if (l == 0 || !reachable[l - 1] || EndsControlFlow(labels[l - 1])) {
+            chains.emplace_back();
+        }
+        chains.back().push_back(l);
+        chainOf[l] = chains.size() - 1;
+    }
+    stats.chains = chains.size();
+
+    std::vector<uint64_t> weights(labels.size());
+    for (size_t l = 0; l < labels.size(); l++) {
+        weights[l] = profile.Count(labels[l].name);
+    }
+
+    //A jump or call is as hot as the colder of its two labels
+    struct Edge {
+        size_t from;
+        size_t to;
+        uint64_t weight;
+        bool tailJump; //JMP ending the label, becomes a fall-through if the target is placed next
+    };
+    std::vector<Edge> edges;
+    for (size_t l = 0; l < labels.size(); l++) {
+        if (!reachable[l]) {
+            continue;
+        }
+        for (auto& i : labels[l].instructions) {
+            if (!IsLabelJump(i)) {
+                continue;
+            }
+            size_t target = labelBySymbol[i.args[i.argCount - 1].value];
+            if (target < labels.size() && std::min(weights[l], weights[target]) > 0) {
+                edges.push_back(Edge{ l, target, std::min(weights[l], weights[target]), &i == &labels[l].instructions.back() && i.inst == INST_JMP });
+            }
+        }
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+
+    auto join = [&](size_t first, size_t second) {
+        for (size_t l : chains[second]) {
+            chainOf[l] = first;
+        }
+        chains[first].insert(chains[first].end(), chains[second].begin(), chains[second].end());
+        chains[second].clear();
+    };
+    //Fall-throughs first so a call between the same chains cannot take the place behind the jump
+    for (const Edge& edge : edges) {
+        size_t first = chainOf[edge.from];
+        size_t second = chainOf[edge.to];
+        if (edge.tailJump && first != second && second != 0 && chains[first].back() == edge.from && chains[second].front() == edge.to) {
+            join(first, second);
+        }
+    }
+    for (const Edge& edge : edges) {
+        size_t first = chainOf[edge.from];
+        size_t second = chainOf[edge.to];
+        if (first != second) {
+            join(second == 0 ? second : first, second == 0 ? first : second); //Nothing goes before .main
+        }
+    }
+
+    std::vector<size_t> order(chains.size());
+    std::vector<uint64_t> heat(chains.size());
+    for (size_t c = 0; c < chains.size(); c++) {
+        order[c] = c;
+        for (size_t l : chains[c]) {
+            heat[c] = std::max(heat[c], weights[l]);
+        }
+    }
+    std::stable_sort(order.begin() + 1, order.end(), [&](size_t a, size_t b) { return heat[a] > heat[b]; });
+
+    std::vector<AsmLabel> laidOut;
+    for (size_t c : order) {
+        for (size_t l : chains[c]) {
+            laidOut.push_back(labels[l]);
+        }
+    }
+    for (size_t l = 0; l + 1 < laidOut.size(); l++) {
+        std::span<AsmInstruction>& instructions = laidOut[l].instructions;
+        if (!instructions.empty() && instructions.back().inst == INST_JMP && instructions.back().args[0].type == Type_Label
+            && instructions.back().args[0].value == laidOut[l + 1].symbol) {
+            instructions = instructions.first(instructions.size() - 1);
+            stats.fallThroughs++;
+        }
+    }
+    labels = std::move(laidOut);
+    return stats;
+}
+
+static bool HasShortImmediate(const AsmInstruction& asmInst) {
+    switch (asmInst.inst)
+    {
+    case INST_ADD:
+    case INST_SUB:
+    case INST_CMP:
+    case INST_MOV:
+        return asmInst.args[0].type == Type_Register && asmInst.args[1].type == Type_Word && asmInst.args[1].value <= 0xFF;
+    case INST_PUSH:
+        return asmInst.args[0].type == Type_Word && asmInst.args[0].value <= 0xFF;
+    default:
+        return false;
+    }
+}
+static bool IsRelaxableBranch(const AsmInstruction& asmInst) {
+    return asmInst.inst != INST_JSR && IsLabelJump(asmInst); //JSR has no short form
+}
+//Assigns every label the address it will be encoded at with the current operand types
+static void LayoutLabels(std::vector<AsmLabel>& labels, AsmSymbolTable& symbols) {
+    Word address = 0;
+    for (auto& label : labels) {
+        label.memAddress = address;
+        symbols.addresses[label.symbol] = address;
+        for (auto& i : label.instructions) {
+            address += GetInstructionSize(i, address);
+        }
+    }
+}
+//Picks short form encodings. Branches start short and are widened until every displacement fits,
+//widening only ever grows the image so the iteration terminates. Returns the number of short branches
+static size_t RelaxEncodings(std::vector<AsmLabel>& labels, AsmSymbolTable& symbols) {
+    size_t shortBranches = 0;
+    for (auto& label : labels) {
+        for (auto& i : label.instructions) {
+            if (HasShortImmediate(i)) {
+                i.args[i.argCount - 1].type = Type_Byte;
+            }
+            else if (IsRelaxableBranch(i)) {
+                i.args[i.argCount - 1].type = Type_Relative;
+                shortBranches++;
+            }
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        LayoutLabels(labels, symbols);
+
+        for (auto& label : labels) {
+            Word address = label.memAddress;
+            for (auto& i : label.instructions) {
+                address += GetInstructionSize(i, address);
+                if (i.argCount == 0 || i.args[i.argCount - 1].type != Type_Relative) {
+                    continue;
+                }
+
+                AsmArgument& target = i.args[i.argCount - 1];
+
+                int displacement = GetLabelValue(target.value, symbols) - address;
+                if (displacement < INT8_MIN || displacement > INT8_MAX) {
+                    target.type = Type_Label;
+                    shortBranches--;
+                    changed = true;
+                    address += 1; //Later branches in this pass see the widened instruction
+                }
+            }
+        }
+    }
+    return shortBranches;
+}
+
+//State of one assembly, passed through the phases ParseAssembly runs in order
+struct AsmProgram {
+    AsmArena arena;
+    AsmSymbolTable symbols;
+    std::vector<AsmLabel> labels;
+    std::vector<std::string_view> tokens; //Tokens of all labels, each label owns a contiguous range
+    std::vector<AsmFixup> fixups; //Uses of labels in progmem that are patched once every label has an address
+};
+
+//".define name body" or ".define name(a, b) body", the rest of the line after .define. The body ends at a comment
+static void DefineMacro(std::span<char> line, AsmSymbolTable& symbols) {
+    std::transform(line.begin(), line.end(), line.begin(), [](unsigned char c) { return std::tolower(c); });
+    std::string_view rest(line.data(), line.size());
+    rest = rest.substr(0, rest.find(';'));
+    auto trim = [](std::string_view str) {
+        while (!str.empty() && IsBlank(str.front())) {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && IsBlank(str.back())) {
+            str.remove_suffix(1);
+        }
+        return str;
+    };
+    rest = trim(rest);
+
+    size_t nameEnd = 0;
+    while (nameEnd < rest.size() && IsIdentifierChar(rest[nameEnd])) {
+        nameEnd++;
+    }
+    std::string_view name = rest.substr(0, nameEnd);
+    if (!IsIdentifier(name) || IsRegisterName(name)) {
+        throw Except(("ERROR: Invalid macro name: " + std::string(rest)).c_str());
+    }
+
+    AsmMacro macro{ false, {}, {} };
+    rest.remove_prefix(nameEnd);
+    if (!rest.empty() && rest.front() == '(') {
+        size_t close = rest.find(')');
+        if (close == std::string_view::npos) {
+            throw Except(("ERROR: Missing ) in macro: " + std::string(name)).c_str());
+        }
+        macro.function = true;
+        std::string_view list = trim(rest.substr(1, close - 1));
+        while (!list.empty()) {
+            size_t comma = std::min(list.find(','), list.size());
+            std::string_view param = trim(list.substr(0, comma));
+            if (!IsIdentifier(param)) {
+                throw Except(("ERROR: Invalid macro parameter: " + std::string(name)).c_str());
+            }
+            macro.params.push_back(param);
+            list = comma < list.size() ? list.substr(comma + 1) : std::string_view();
+        }
+        rest.remove_prefix(close + 1);
+    }
+    macro.body = trim(rest);
+    if (macro.body.empty()) {
+        throw Except(("ERROR: Macro has no body: " + std::string(name)).c_str());
+    }
+
+    //Expressions are evaluated again after layout, a redefinition would change the value of earlier uses
+    if (!symbols.defines.try_emplace(name, std::move(macro)).second || macros.find(name) != macros.end()) {
+        throw Except(("ERROR: Macro defined twice: " + std::string(name)).c_str());
+    }
+}
+
+//Splits the source into labels and tokens, removes comments, records macro definitions and substitutes macros
+static void TokenizeAssembly(const std::string& input, AsmProgram& program) {
+    AsmArena& arena = program.arena;
+    std::vector<AsmLabel>& labels = program.labels;
+    std::vector<std::string_view>& tokens = program.tokens;
+
+    //The source is copied into the arena once, tokens are lowered in place and referenced by view
+    std::span<char> source = arena.CopyString(input);
+    size_t pos = 0;
+
+    while (pos < source.size()) { //Tokenise: Handle labels and remove comments, tokenise
+        size_t lineEnd = std::find(source.begin() + pos, source.end(), '\n') - source.begin();
+        bool isFirstWord = true;
+        bool lineHasTokens = false;
+
+        while (pos < lineEnd) {
+            while (pos < lineEnd && IsBlank(source[pos])) {
+                pos++;
+            }
+            size_t wordStart = pos;
+            int depth = 0; //Expressions in parentheses and brackets, and strings can contain blanks
+            bool quoted = false;
+            while (pos < lineEnd && (quoted || depth > 0 || !IsBlank(source[pos]))) {
+                char c = source[pos];
+                if (c == '"') {
+                    quoted = !quoted;
+                }
+                else if (quoted && c == '\\' && pos + 1 < lineEnd) {
+                    pos++; //Escaped character
+                }
+                else if (!quoted) {
+                    depth += c == '(' || c == '[' ? 1 : c == ')' || c == ']' ? -1 : 0;
+                }
+                pos++;
+            }
+            if (wordStart == pos) {
+                break;
+            }
+            std::span<char> word = source.subspan(wordStart, pos - wordStart);
+
+            if (word.back() == ':') {
+                if (isFirstWord) {
+                    if (!labels.empty()) {
+                        labels.back().lastToken = tokens.size();
+                    }
+
+                    std::string_view name(word.data(), word.size() - 1); //Label
+                    labels.push_back(AsmLabel{ name, program.symbols.Intern(name), tokens.size(), tokens.size(), {}, 0 });
+                    break;
+                }
+                else {
+                    throw Except("Labels cannot have spaces");
+                }
+            }
+            else if (word.front() == ';') {
+                break;
+            }
+            else if (isFirstWord && std::string_view(word.data(), word.size()) == ".define") {
+                DefineMacro(source.subspan(pos, lineEnd - pos), program.symbols);
+                break;
+            }
+            else if (labels.empty()) {
+                throw Except("Instructions must be inside a label");
+            }
+            else {
+                //Lower string, quoted strings are data and keep their case
+                if (word.front() != '"') {
+                    std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return std::tolower(c); });
+                }
+
+                //Replace macros that are a whole token, the rest are expanded when the operand expressions are evaluated
+                std::string_view token(word.data(), word.size());
+                auto define = program.symbols.defines.find(token);
+                auto macro = macros.find(token);
+                if (define != program.symbols.defines.end() && !define->second.function) {
+                    token = define->second.body;
+                }
+                else if (macro != macros.end()) {
+                    token = macro->second;
+                }
+                tokens.push_back(token);
+                lineHasTokens = true;
+            }
+
+            isFirstWord = false;
+        }
+
+        if (lineHasTokens) {
+            tokens.push_back("\n"); //For knowing which token is first on a line
+        }
+        pos = lineEnd + 1;
+    }
+    if (!labels.empty()) {
+        labels.back().lastToken = tokens.size();
+    }
+
+    //Move the .main label to the front
+    auto pivot = std::find_if(labels.begin(), labels.end(),
+        [](const AsmLabel& label) -> bool {
+            return label.name == ".main";
+        });
+    if (pivot != labels.end()) {
+        std::rotate(labels.begin(), pivot, pivot + 1);
+    }
+    else {
+        throw Except("The program must contain the .main label");
+    }
+}
+
+//Builds the instructions of every label from its tokens, then lays them out and optimizes them as the options ask
+static void ParseLabels(AsmProgram& program, const AsmOptions& options) {
+    for (auto& label : program.labels) {
+        label.Parse(program.arena, program.symbols, program.tokens, options.verbose);
+    }
+
+    if (options.profile != nullptr) {
+        AsmLayoutStats stats = ReorderLabels(program.labels, program.symbols, *options.profile);
+        if (options.verbose) {
+            std::printf("Profile layout: %zu chains, %zu unreachable labels dropped, %zu jumps became fall-throughs\n",
+                stats.chains, stats.dropped, stats.fallThroughs);
+        }
+    }
+
+    if (options.optimize) {
+        AsmOptimizerStats stats = OptimizeAssembly(program.labels, program.symbols);
+        if (options.verbose) {
+            std::printf("Optimizer: %zu removed, %zu rewritten, %zu jumps threaded, %zu bytes saved (~%zu cycles per pass over the program)\n",
+                stats.removed, stats.rewritten, stats.threaded, stats.bytesSaved, stats.bytesSaved);
+        }
+    }
+}
+
+//Picks encodings and writes the instructions, uses of labels are left as placeholders in program.fixups
+static void EncodeAssembly(AsmProgram& program, std::vector<Byte>& progmem, const AsmOptions& options) {
+    AsmSymbolTable& symbols = program.symbols;
+    std::vector<AsmLabel>& labels = program.labels;
+    std::vector<AsmFixup>& fixups = program.fixups;
+
+    size_t shortBranches = RelaxEncodings(labels, symbols);
+    if (options.verbose) {
+        std::printf("Branch relaxation: %zu branches use the short form\n", shortBranches);
+    }
+
+    //Encoding
+    for (auto& label : labels) {
+        //Update memory address for the label
+        //Used later for updating label values
+        label.memAddress = static_cast<Word>(progmem.size());
+        symbols.addresses[label.symbol] = label.memAddress;
+
+        //Write to program memory
+        for (auto& i : label.instructions) {
+            size_t end = progmem.size() + GetInstructionSize(i, static_cast<Word>(progmem.size())); //PC relative displacements are taken from here
+
+            if (IsFlagBranch(i) && i.args[0].type == Type_Label) {
+                progmem.push_back(GetOpcode(i) ^ 1); //Opposite condition skips over the JMP
+                progmem.push_back(3);
+                progmem.push_back(OP_JMP);
+                fixups.push_back(AsmFixup{ progmem.size(), i.args[0].value });
+                progmem.push_back(0);
+                progmem.push_back(0);
+                continue;
+            }
+
+            if (i.inst == INST_FILL || i.inst == INST_ALIGN) {
+                progmem.resize(end, i.inst == INST_FILL && i.argCount > 1 ? static_cast<Byte>(i.args[1].value) : 0);
+                continue;
+            }
+            if (!IsDirective(i.inst)) {
+                progmem.push_back(GetOpcode(i));
+            }
+
+            //Stores are written "mov [address] value" but the CPU reads the value before the address
+            AsmInstruction encoded = i;
+            if (i.inst == INST_MOV && (i.args[0].type == Type_Address || i.args[0].type == Type_AddressRegister)) {
+                std::swap(encoded.args[0], encoded.args[1]);
+            }
+
+            for (auto& arg : encoded.Args()) {
+                if (arg.symbolic) {
+                    fixups.push_back(AsmFixup{ progmem.size(), arg.value });
+                    progmem.push_back(0);
+                    progmem.push_back(0);
+                    continue;
+                }
+                switch (arg.type)
+                {
+                case Type_Word:
+                case Type_Address:
+                    //Little endian system (least significant portion first)
+                    progmem.push_back(arg.value & 0xFF);
+                    progmem.push_back(arg.value >> 8);
+                    break;
+                case Type_Register:
+                case Type_AddressRegister:
+                case Type_Byte:
+                    progmem.push_back((Byte)arg.value);
+                    break;
+                case Type_Relative:
+                    progmem.push_back((Byte)(GetLabelValue(arg.value, symbols) - end));
+                    break;
+                case Type_Label:
+                    fixups.push_back(AsmFixup{ progmem.size(), arg.value });
+
+                    //Placeholder value
+                    progmem.push_back(0);
+                    progmem.push_back(0);
+                    break;
+                }
+            }
+        }
+    }
+
+}
+
+//Patches the label addresses into the placeholders and exports the symbols
+static void ResolveFixups(AsmProgram& program, std::vector<Byte>& progmem, SymbolMap& symbolMap) {
+    for (auto& fixup : program.fixups) {
+        Word value = GetLabelValue(fixup.symbol, program.symbols);
+
+        progmem[fixup.index] = value & 0xFF;
+        progmem[fixup.index + 1] = value >> 8;
+    }
+
+    for (auto& label : program.labels) {
+        symbolMap.Add(label.memAddress, std::string(label.name));
+    }
+}
+
+static void ParseAssembly(const std::string& input, std::vector<Byte>& progmem, SymbolMap& symbolMap, const AsmOptions& options = {}) {
+    AsmProgram program;
+    TokenizeAssembly(input, program);
+    ParseLabels(program, options);
+    EncodeAssembly(program, progmem, options);
+    ResolveFixups(program, progmem, symbolMap);
+}
+//inline rather than static: DIS-Tests includes the assembler but never writes an image
+inline void SerializeToDisk(std::vector<Byte>& data, std::string filename, bool verbose = true) {
+    if (verbose) {
+        std::printf("Writing program to disk...\n");
+    }
+    std::ofstream outfile(filename, std::ios::out | std::ios::binary);
+    outfile.write(reinterpret_cast<const char*>(data.data()), data.size()); //this is head ache
+    if (verbose) {
+        std::printf(("Finished writing program to disk: \"" + filename + "\"\n").c_str());
+    }
+}
@@ -0,0 +1,565 @@
+#include "../DIS-Assembler/assembler.h"
+#include "../DIS-Emulator/disassembler.h"
+#include "generator.h"
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <malloc.h>
+#include <new>
+#include <sstream>
+#include <string_view>
+
+#ifndef DIS_BENCH_WORKLOADS
+#define DIS_BENCH_WORKLOADS "workloads" //Relative to the working directory, which is the project directory in Visual Studio
+#endif
+
+/// <summary>
+/// Emulator throughput benchmark. Each workload is assembled from workloads/*.dis and run on CPU::Execute for a fixed number
+/// of guest cycles, the fastest of several repeats is reported.
+///  - Workloads never halt, so every repeat runs exactly the requested budget
+///  - Results are written as JSON. Given a baseline file from an earlier run, workloads whose ns per instruction got worse
+///    by more than the threshold are reported and the exit code is 1
+/// With -assembler it benchmarks the assembler instead, on programs from SourceGenerator. Every phase of ParseAssembly and
+/// SerializeToDisk is timed separately and reports lines per second, the peak heap size and the number of allocations.
+/// With -disassembler it measures how fast Disassembler decodes, formats and follows control flow through a generated image
+/// </summary>
+
+//Heap accounting for the assembler benchmark. Every allocation of the process goes through here, the benchmark is single threaded
+static uint64_t heapAllocations = 0;
+static size_t heapLive = 0;
+static size_t heapPeak = 0;
+
+//Sizes are the allocator's usable size of the block, so they include its rounding
+static size_t HeapBlockSize(void* block) {
+#ifdef _WIN32
+    return _msize(block);
+#else
+    return malloc_usable_size(block);
+#endif
+}
+
+void* operator new(size_t size) {
+    void* block = std::malloc(size != 0 ? size : 1);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    heapAllocations++;
+    heapLive += HeapBlockSize(block);
+    heapPeak = std::max(heapPeak, heapLive);
+    return block;
+}
+void operator delete(void* pointer) noexcept {
+    if (pointer == nullptr) {
+        return;
+    }
+    heapLive -= HeapBlockSize(pointer);
+    std::free(pointer);
+}
+void operator delete(void* pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+//The shipped CPU configuration, without the console warnings a budget overrun at the end of every slice would print
+struct BenchCPUPolicy : CPUPolicy
+{
+    static constexpr bool Logging = false;
+};
+using BenchCPU = BasicCPU<BenchCPUPolicy>;
+
+struct Workload
+{
+    const char* name;
+    i64 slice;              //Cycles per Execute call
+    bool interruptEverySlice; //Raise I_0 before every Execute call
+    Byte progress;          //Register the main loop changes. Workloads with interruptEverySlice also count the handled interrupts in r0
+};
+static const Workload workloads[] = {
+    { "arithmetic", 100000, false, 0 },
+    { "recursion", 100000, false, 3 },
+    { "memcpy", 100000, false, 4 },
+    { "branches", 100000, false, 0 },
+    { "interrupts", 200, true, 1 },
+};
+
+struct BenchResult
+{
+    std::string name;
+    uint64_t instructions = 0;  //Instructions and interrupt entries (CPU::retired)
+    uint64_t cycles = 0;
+    double seconds = 0;
+    double baseline = 0;        //ns per instruction of the baseline, 0 if it has no such workload
+
+    double NsPerInstruction() const {
+        return seconds * 1e9 / instructions;
+    }
+    double Mips() const {
+        return instructions / seconds / 1e6;
+    }
+    double CyclesPerSecond() const {
+        return cycles / seconds;
+    }
+    //Positive when slower than the baseline
+    double Change() const {
+        return baseline > 0 ? (NsPerInstruction() / baseline - 1) * 100 : 0;
+    }
+};
+
+static std::vector<Byte> AssembleWorkload(const std::string& path) {
+    std::ifstream stream(path);
+    if (!stream) {
+        throw Except(("ERROR: Cannot open workload " + path).c_str());
+    }
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+
+    std::vector<Byte> progmem;
+    SymbolMap symbolMap;
+    AsmOptions options;
+    options.verbose = false;
+    ParseAssembly(buffer.str(), progmem, symbolMap, options);
+    return progmem;
+}
+
+static BenchResult RunWorkload(const Workload& workload, const std::vector<Byte>& progmem, i64 cycles, int repeats) {
+    BenchResult best;
+    best.name = workload.name;
+
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        Memory mem{};
+        BenchCPU cpu{};
+        cpu.Reset(mem);
+        memcpy(mem.Data, progmem.data(), progmem.size());
+
+        i64 slices = 0;
+        auto slice = [&]() {
+            if (workload.interruptEverySlice) {
+                cpu.SetInterrupt(I_0);
+            }
+            cpu.Execute(workload.slice, mem);
+            slices++;
+        };
+        for (i64 warmup = 0; warmup < cycles / 10; warmup += workload.slice) {
+            slice();
+        }
+
+        uint64_t startRetired = cpu.retired;
+        uint64_t startElapsed = cpu.elapsed;
+        Word startProgress = cpu.registers[workload.progress];
+        auto start = std::chrono::steady_clock::now();
+        for (i64 done = 0; done < cycles; done += workload.slice) {
+            slice();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (cpu.halted) {
+            throw Except(("ERROR: Workload " + best.name + " halted").c_str());
+        }
+        //A livelocked workload still retires instructions, it has to show that it got somewhere
+        if (cpu.registers[workload.progress] == startProgress || (workload.interruptEverySlice && cpu.registers.R0 != (Word)slices)) {
+            throw Except(("ERROR: Workload " + best.name + " made no progress").c_str());
+        }
+        if (repeat == 0 || seconds * best.instructions < best.seconds * (cpu.retired - startRetired)) {
+            best.instructions = cpu.retired - startRetired;
+            best.cycles = cpu.elapsed - startElapsed;
+            best.seconds = seconds;
+        }
+    }
+    return best;
+}
+
+//Reads ns_per_instruction of every workload from a file written by WriteResults
+static std::map<std::string, double> ReadBaseline(const std::string& path) {
+    std::ifstream stream(path);
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    std::string json = buffer.str();
+
+    std::map<std::string, double> baseline;
+    const std::string nameKey = "\"name\": \"";
+    const std::string valueKey = "\"ns_per_instruction\": ";
+    size_t pos = 0;
+    while ((pos = json.find(nameKey, pos)) != std::string::npos) {
+        size_t nameStart = pos + nameKey.size();
+        size_t nameEnd = json.find('"', nameStart);
+        size_t value = json.find(valueKey, nameEnd);
+        if (nameEnd == std::string::npos || value == std::string::npos) {
+            break;
+        }
+        baseline[json.substr(nameStart, nameEnd - nameStart)] = std::strtod(json.c_str() + value + valueKey.size(), nullptr);
+        pos = value;
+    }
+    return baseline;
+}
+
+static bool WriteResults(const std::string& path, const std::vector<BenchResult>& results, i64 cycles, int repeats) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fprintf(file, "{\n  \"cycles\": %lld,\n  \"repeats\": %d,\n  \"workloads\": [\n", (long long)cycles, repeats);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        std::fprintf(file, "    {\n      \"name\": \"%s\",\n", result.name.c_str());
+        std::fprintf(file, "      \"instructions\": %llu,\n", (unsigned long long)result.instructions);
+        std::fprintf(file, "      \"cycles\": %llu,\n", (unsigned long long)result.cycles);
+        std::fprintf(file, "      \"seconds\": %.6f,\n", result.seconds);
+        std::fprintf(file, "      \"ns_per_instruction\": %.4f,\n", result.NsPerInstruction());
+        std::fprintf(file, "      \"mips\": %.3f,\n", result.Mips());
+        std::fprintf(file, "      \"cycles_per_second\": %.0f", result.CyclesPerSecond());
+        if (result.baseline > 0) {
+            std::fprintf(file, ",\n      \"baseline_ns_per_instruction\": %.4f,\n      \"change_percent\": %.2f",
+                result.baseline, result.Change());
+        }
+        std::fprintf(file, "\n    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+struct AsmPhase
+{
+    const char* name;
+    double seconds = 0;
+    uint64_t allocations = 0;
+    size_t peakBytes = 0;   //Largest heap size while the phase ran, including what earlier phases left allocated
+};
+struct AsmBenchResult
+{
+    size_t lines = 0;
+    size_t sourceBytes = 0;
+    size_t imageBytes = 0;
+    std::vector<AsmPhase> phases;
+
+    double TotalSeconds() const {
+        double total = 0;
+        for (const AsmPhase& phase : phases) {
+            total += phase.seconds;
+        }
+        return total;
+    }
+    const AsmPhase& Dominant() const {
+        return *std::max_element(phases.begin(), phases.end(), [](const AsmPhase& a, const AsmPhase& b) { return a.seconds < b.seconds; });
+    }
+};
+
+static AsmBenchResult RunAssembler(const SourceGenerator& generator, int repeats) {
+    const char* imagePath = "bench_program.disa";
+    std::string source = generator.Generate();
+    AsmBenchResult best;
+    best.lines = std::count(source.begin(), source.end(), '\n');
+    best.sourceBytes = source.size();
+    best.phases = { { "tokenize" }, { "parse" }, { "encode" }, { "fixup" }, { "serialize" } };
+
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        std::vector<AsmPhase> phases = best.phases;
+        auto measure = [&](AsmPhase& phase, auto&& run) {
+            heapPeak = heapLive;
+            uint64_t allocations = heapAllocations;
+            auto start = std::chrono::steady_clock::now();
+            run();
+            phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            phase.allocations = heapAllocations - allocations;
+            phase.peakBytes = heapPeak;
+        };
+
+        AsmOptions options;
+        options.verbose = false;
+        {
+            AsmProgram program;
+            std::vector<Byte> progmem;
+            SymbolMap symbolMap;
+            measure(phases[0], [&] { TokenizeAssembly(source, program); });
+            measure(phases[1], [&] { ParseLabels(program, options); });
+            measure(phases[2], [&] { EncodeAssembly(program, progmem, options); });
+            measure(phases[3], [&] { ResolveFixups(program, progmem, symbolMap); });
+            measure(phases[4], [&] { SerializeToDisk(progmem, imagePath, false); });
+            best.imageBytes = progmem.size();
+        }
+        std::remove(imagePath);
+
+        for (size_t i = 0; i < phases.size(); i++) {
+            if (repeat == 0 || phases[i].seconds < best.phases[i].seconds) {
+                best.phases[i] = phases[i];
+            }
+        }
+    }
+    return best;
+}
+
+static void PrintAssemblerResult(const AsmBenchResult& result) {
+    printf("\n%zu lines, %.1f MB source, %zu byte image%s\n", result.lines, result.sourceBytes / 1e6, result.imageBytes,
+        result.imageBytes > Memory::MEM_SIZE ? " (larger than guest memory, only the assembler speed is meaningful)" : "");
+    printf("%-10s %10s %14s %12s %10s %7s\n", "Phase", "ms", "Lines/s", "Allocations", "Peak MB", "Share");
+    for (const AsmPhase& phase : result.phases) {
+        printf("%-10s %10.2f %14.0f %12llu %10.1f %6.1f%%\n", phase.name, phase.seconds * 1e3, result.lines / phase.seconds,
+            (unsigned long long)phase.allocations, phase.peakBytes / 1e6, phase.seconds / result.TotalSeconds() * 100);
+    }
+    printf("%-10s %10.2f %14.0f   dominated by %s\n", "total", result.TotalSeconds() * 1e3, result.lines / result.TotalSeconds(),
+        result.Dominant().name);
+}
+
+static bool WriteAssemblerResults(const std::string& path, const std::vector<AsmBenchResult>& results, const SourceGenerator& generator, int repeats) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fprintf(file, "{\n  \"repeats\": %d,\n  \"label_every\": %zu,\n  \"forward_references\": %.3f,\n  \"comment_density\": %.3f,\n  \"seed\": %u,\n",
+        repeats, generator.labelEvery, generator.forwardReferences, generator.commentDensity, generator.seed);
+    std::fprintf(file, "  \"sizes\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const AsmBenchResult& result = results[i];
+        std::fprintf(file, "    {\n      \"lines\": %zu,\n      \"source_bytes\": %zu,\n      \"image_bytes\": %zu,\n",
+            result.lines, result.sourceBytes, result.imageBytes);
+        std::fprintf(file, "      \"lines_per_second\": %.0f,\n      \"dominant_phase\": \"%s\",\n      \"phases\": [\n",
+            result.lines / result.TotalSeconds(), result.Dominant().name);
+        for (size_t p = 0; p < result.phases.size(); p++) {
+            const AsmPhase& phase = result.phases[p];
+            std::fprintf(file, "        { \"name\": \"%s\", \"seconds\": %.6f, \"lines_per_second\": %.0f, \"allocations\": %llu, \"peak_bytes\": %zu }%s\n",
+                phase.name, phase.seconds, result.lines / phase.seconds, (unsigned long long)phase.allocations, phase.peakBytes,
+                p + 1 < result.phases.size() ? "," : "");
+        }
+        std::fprintf(file, "      ]\n    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+struct DisasmPhase
+{
+    const char* name;
+    double seconds = 0;
+    uint64_t bytes = 0;         //Image bytes processed, over all passes
+    uint64_t instructions = 0;
+
+    double MegabytesPerSecond() const {
+        return bytes / seconds / 1e6;
+    }
+};
+
+//Passes over the image until minimumBytes were processed, so small images still run long enough to time
+static std::vector<DisasmPhase> RunDisassembler(const std::vector<Byte>& image, const SymbolMap& symbols, uint64_t minimumBytes, int repeats) {
+    Disassembler disassembler(image.data(), image.size(), 0, &symbols);
+    std::vector<DisasmPhase> best = { { "decode" }, { "format" }, { "flow" } };
+    std::vector<Word> entries; //Generated code does not all hang off .main, every label starts code
+    for (auto& [address, name] : symbols.labels) {
+        entries.push_back(address);
+    }
+    char text[Disassembler::MAX_TEXT];
+    uint64_t checksum = 0; //Keeps the work from being optimized away
+
+    for (int repeat = 0; repeat < repeats; repeat++) {
+        std::vector<DisasmPhase> phases = best;
+        auto measure = [&](DisasmPhase& phase, auto&& pass) {
+            phase.bytes = 0;
+            phase.instructions = 0;
+            auto start = std::chrono::steady_clock::now();
+            while (phase.bytes < minimumBytes) {
+                phase.instructions += pass();
+                phase.bytes += disassembler.size;
+            }
+            phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        measure(phases[0], [&] {
+            uint64_t count = 0;
+            disassembler.Sweep(0, Memory::MEM_SIZE, [&](const DecodedInstruction& inst) {
+                checksum += inst.operands[0];
+                count++;
+            });
+            return count;
+        });
+        measure(phases[1], [&] {
+            uint64_t count = 0;
+            disassembler.Sweep(0, Memory::MEM_SIZE, [&](const DecodedInstruction& inst) {
+                checksum += disassembler.Format(inst, text);
+                count++;
+            });
+            return count;
+        });
+        measure(phases[2], [&] {
+            std::vector<bool> code = disassembler.FollowFlow(entries);
+            return (uint64_t)std::count(code.begin(), code.end(), true);
+        });
+
+        for (size_t i = 0; i < phases.size(); i++) {
+            if (repeat == 0 || phases[i].MegabytesPerSecond() > best[i].MegabytesPerSecond()) {
+                best[i] = phases[i];
+            }
+        }
+    }
+    if (checksum == 1) {
+        printf("\n");
+    }
+    return best;
+}
+
+static bool WriteDisassemblerResults(const std::string& path, const std::vector<DisasmPhase>& phases, size_t imageBytes, int repeats) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::fprintf(file, "{\n  \"repeats\": %d,\n  \"image_bytes\": %zu,\n  \"phases\": [\n", repeats, imageBytes);
+    for (size_t i = 0; i < phases.size(); i++) {
+        const DisasmPhase& phase = phases[i];
+        std::fprintf(file, "    { \"name\": \"%s\", \"megabytes_per_second\": %.1f, \"instructions_per_second\": %.0f }%s\n",
+            phase.name, phase.MegabytesPerSecond(), phase.instructions / phase.seconds, i + 1 < phases.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    std::fclose(file);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    //Usage: DIS-Bench [-cycles n] [-repeat n] [-workloads directory] [-out file] [-baseline file] [-threshold percent] [workload...]
+    //       DIS-Bench -assembler [-lines n]... [-labels lines per label] [-forward fraction] [-comments fraction] [-seed n] [-repeat n] [-out file]
+    //       DIS-Bench -disassembler [-lines n] [-seed n] [-repeat n] [-out file]
+    i64 cycles = 50000000;
+    int repeats = 5;
+    std::string directory = DIS_BENCH_WORKLOADS;
+    std::string outPath;
+    std::string baselinePath;
+    double threshold = 10;
+    std::vector<std::string_view> selected;
+    bool assembler = false;
+    bool disassembler = false;
+    SourceGenerator generator;
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "-assembler") {
+            assembler = true;
+        }
+        else if (arg == "-disassembler") {
+            disassembler = true;
+        }
+        else if (arg == "-lines" && i + 1 < argc) {
+            sizes.push_back(std::stoull(argv[++i]));
+        }
+        else if (arg == "-labels" && i + 1 < argc) {
+            generator.labelEvery = std::stoull(argv[++i]);
+        }
+        else if (arg == "-forward" && i + 1 < argc) {
+            generator.forwardReferences = std::stod(argv[++i]);
+        }
+        else if (arg == "-comments" && i + 1 < argc) {
+            generator.commentDensity = std::stod(argv[++i]);
+        }
+        else if (arg == "-seed" && i + 1 < argc) {
+            generator.seed = (uint32_t)std::stoul(argv[++i]);
+        }
+        else if (arg == "-cycles" && i + 1 < argc) {
+            cycles = std::stoll(argv[++i]);
+        }
+        else if (arg == "-repeat" && i + 1 < argc) {
+            repeats = std::max(1, std::stoi(argv[++i]));
+        }
+        else if (arg == "-workloads" && i + 1 < argc) {
+            directory = argv[++i];
+        }
+        else if (arg == "-out" && i + 1 < argc) {
+            outPath = argv[++i];
+        }
+        else if (arg == "-baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        }
+        else if (arg == "-threshold" && i + 1 < argc) {
+            threshold = std::stod(argv[++i]);
+        }
+        else {
+            selected.push_back(arg);
+        }
+    }
+
+    if (assembler) {
+        if (sizes.empty()) {
+            sizes = { 10000, 100000, 1000000 };
+        }
+        outPath = outPath.empty() ? "bench_assembler.json" : outPath;
+        std::vector<AsmBenchResult> results;
+        for (size_t lines : sizes) {
+            generator.lines = lines;
+            results.push_back(RunAssembler(generator, repeats));
+            PrintAssemblerResult(results.back());
+        }
+        if (!WriteAssemblerResults(outPath, results, generator, repeats)) {
+            printf("ERROR: Cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+        printf("\nResults written to %s\n", outPath.c_str());
+        return 0;
+    }
+
+    if (disassembler) {
+        //The largest generated program that still fits guest memory by default
+        generator.lines = sizes.empty() ? 16000 : sizes.front();
+        std::vector<Byte> image;
+        SymbolMap symbols;
+        AsmOptions options;
+        options.verbose = false;
+        ParseAssembly(generator.Generate(), image, symbols, options);
+        if (image.size() > Memory::MEM_SIZE) {
+            printf("ERROR: The %zu byte image is larger than guest memory, use fewer -lines\n", image.size());
+            return 1;
+        }
+
+        outPath = outPath.empty() ? "bench_disassembler.json" : outPath;
+        std::vector<DisasmPhase> phases = RunDisassembler(image, symbols, 64000000, repeats);
+        printf("%zu byte image, %zu labels\n", image.size(), symbols.labels.size());
+        printf("%-10s %10s %16s\n", "Phase", "MB/s", "Instructions/s");
+        for (const DisasmPhase& phase : phases) {
+            printf("%-10s %10.1f %16.0f\n", phase.name, phase.MegabytesPerSecond(), phase.instructions / phase.seconds);
+        }
+        if (!WriteDisassemblerResults(outPath, phases, image.size(), repeats)) {
+            printf("ERROR: Cannot write %s\n", outPath.c_str());
+            return 1;
+        }
+        printf("\nResults written to %s\n", outPath.c_str());
+        return 0;
+    }
+
+    outPath = outPath.empty() ? "bench.json" : outPath;
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty()) {
+        baseline = ReadBaseline(baselinePath);
+        if (baseline.empty()) {
+            printf("ERROR: %s has no benchmark results\n", baselinePath.c_str());
+            return 1;
+        }
+    }
+
+    printf("%-12s %14s %14s %10s %10s %14s %10s\n", "Workload", "Instructions", "Cycles", "ns/inst", "MIPS", "Cycles/s", "Change");
+    std::vector<BenchResult> results;
+    bool regressed = false;
+    for (const Workload& workload : workloads) {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), workload.name) == selected.end()) {
+            continue;
+        }
+        BenchResult result = RunWorkload(workload, AssembleWorkload(directory + "/" + workload.name + ".dis"), cycles, repeats);
+        auto previous = baseline.find(result.name);
+        if (previous != baseline.end()) {
+            result.baseline = previous->second;
+        }
+
+        printf("%-12s %14llu %14llu %10.3f %10.2f %14.0f", result.name.c_str(), (unsigned long long)result.instructions,
+            (unsigned long long)result.cycles, result.NsPerInstruction(), result.Mips(), result.CyclesPerSecond());
+        if (result.baseline > 0) {
+            printf(" %+9.1f%%", result.Change());
+            if (result.Change() > threshold) {
+                printf(" REGRESSION");
+                regressed = true;
+            }
+        }
+        printf("\n");
+        results.push_back(result);
+    }
+
+    if (!WriteResults(outPath, results, cycles, repeats)) {
+        printf("ERROR: Cannot write %s\n", outPath.c_str());
+        return 1;
+    }
+    printf("Results written to %s\n", outPath.c_str());
+    return regressed ? 1 : 0;
+}
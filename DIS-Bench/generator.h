@@ -0,0 +1,136 @@
+#pragma once
+#include <random>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Generates synthetic DIS assembly for benchmarking the assembler. The programs assemble but are not meant to be run.
+///  - .main comes first, then labels named l1, l2... start every labelEvery lines on average
+///  - Branches, jumps and calls target a random label, forwardReferences of them one after the current label
+///  - commentDensity of the lines get a comment, half of them on a line of their own and half after an instruction
+///  - The same options and seed always produce the same program
+/// </summary>
+struct SourceGenerator
+{
+    //Relative weights of the instruction groups
+    struct Mix {
+        DWord arithmetic = 40;  //ADD/SUB/MUL/logic/shifts/INC/MOV between registers and constants
+        DWord memory = 20;      //MOV through constant and register addresses
+        DWord branches = 20;    //JRx, CMP followed by a flag branch and JMP to labels
+        DWord calls = 10;       //JSR to labels and RTN
+        DWord stack = 10;       //PUSH/POP
+    };
+
+    size_t lines = 10000;
+    size_t labelEvery = 24;
+    double forwardReferences = 0.5;
+    double commentDensity = 0.2;
+    Mix mix;
+    uint32_t seed = 1;
+
+    std::string Generate() const {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        size_t labelCount = std::max<size_t>(1, lines / std::max<size_t>(1, labelEvery));
+        std::string source;
+        source.reserve(lines * 24);
+
+        size_t label = 0;
+        size_t line = 0;
+        auto emit = [&](const std::string& text) {
+            source += text;
+            if (chance(rng) < commentDensity / 2) {
+                source += " ; synthetic trailing comment";
+            }
+            source += '\n';
+            line++;
+        };
+
+        source += ".main:\n";
+        line++;
+        while (line < lines) {
+            //Next label once this one has its share of the lines, the last label takes the rest
+            if (label + 1 < labelCount && line >= (label + 1) * lines / labelCount) {
+                label++;
+                source += "l" + std::to_string(label) + ":\n";
+                line++;
+                continue;
+            }
+            if (chance(rng) < commentDensity / 2) {
+                source += "\t; synthetic comment line describing the code below\n";
+                line++;
+                continue;
+            }
+
+            auto target = [&]() {
+                bool forward = label + 1 < labelCount && chance(rng) < forwardReferences;
+                size_t index = forward ? std::uniform_int_distribution<size_t>(label + 1, labelCount - 1)(rng)
+                    : std::uniform_int_distribution<size_t>(0, label)(rng);
+                return index == 0 ? std::string(".main") : "l" + std::to_string(index);
+            };
+            std::string a = Register(rng);
+            std::string b = Register(rng);
+
+            DWord pick = std::uniform_int_distribution<DWord>(0, mix.arithmetic + mix.memory + mix.branches + mix.calls + mix.stack - 1)(rng);
+            if (pick < mix.arithmetic) {
+                static const char* const ops[] = { "add", "sub", "mul", "and", "or", "xor" };
+                static const char* const shifts[] = { "lsl", "lsr", "rol", "ror" };
+                switch (std::uniform_int_distribution<int>(0, 5)(rng))
+                {
+                case 0: emit("\t" + std::string(ops[rng() % 6]) + " " + a + " " + b); break;
+                case 1: emit("\t" + std::string(ops[rng() % 6]) + " " + a + " " + Constant(rng)); break;
+                case 2: emit("\t" + std::string(shifts[rng() % 4]) + " " + a + " 0x000" + std::to_string(rng() % 8)); break;
+                case 3: emit("\t" + std::string(rng() % 2 ? "inc " : "dec ") + a); break;
+                case 4: emit("\tmov " + a + " " + b); break;
+                default: emit("\tmov " + a + " " + Constant(rng)); break;
+                }
+            }
+            else if ((pick -= mix.arithmetic) < mix.memory) {
+                switch (std::uniform_int_distribution<int>(0, 3)(rng))
+                {
+                case 0: emit("\tmov " + a + " [" + Address(rng) + "]"); break;
+                case 1: emit("\tmov [" + Address(rng) + "] " + a); break;
+                case 2: emit("\tmov " + a + " [" + b + "]"); break;
+                default: emit("\tmov [" + a + "] " + b); break;
+                }
+            }
+            else if ((pick -= mix.memory) < mix.branches) {
+                static const char* const jumps[] = { "jre", "jrn", "jrg", "jrl", "jrge", "jrle" };
+                static const char* const flagBranches[] = { "beq", "bne", "blt", "bge", "bcs", "bcc" };
+                switch (std::uniform_int_distribution<int>(0, 3)(rng))
+                {
+                case 0: emit("\t" + std::string(jumps[rng() % 6]) + " " + a + " " + Constant(rng) + " " + target()); break;
+                case 1: emit("\tjrz " + a + " " + target()); break;
+                case 2:
+                    emit("\tcmp " + a + " " + b);
+                    emit("\t" + std::string(flagBranches[rng() % 6]) + " " + target());
+                    break;
+                default: emit("\tjmp " + target()); break;
+                }
+            }
+            else if ((pick -= mix.branches) < mix.calls) {
+                emit(rng() % 4 ? "\tjsr " + target() : std::string("\trtn"));
+            }
+            else {
+                emit((rng() % 2 ? "\tpush " : "\tpop ") + a);
+            }
+        }
+        return source;
+    }
+
+private:
+    static std::string Register(std::mt19937& rng) {
+        return "r" + std::to_string(rng() % 6);
+    }
+    static std::string Hex(Word value) {
+        static const char digits[] = "0123456789ABCDEF";
+        return { '0', 'x', digits[value >> 12], digits[(value >> 8) & 15], digits[(value >> 4) & 15], digits[value & 15] };
+    }
+    //Small constants are common, a third fit the short forms
+    static std::string Constant(std::mt19937& rng) {
+        return Hex((Word)(rng() % 3 == 0 ? rng() % 0x100 : rng()));
+    }
+    static std::string Address(std::mt19937& rng) {
+        return Hex((Word)(0x4000 + (rng() % 0x4000) * 2));
+    }
+};
@@ -1,6 +1,6 @@
-#include "cpu.h"
+#include "gdbstub.h"
 
-int main()
+int main(int argc, char** argv)
 {
     Memory mem{};
     CPU cpu{};
@@ -16,8 +16,12 @@ int main()
     mem[0x0007] = 0x00; //Address (bits 8 - 15)
     mem[0x0008] = OP_HALT;
 
-    cpu.Execute(129, mem); //This simply increment loop takes 129 cycles x_x (JRN eats up 6 cycles)
+    if (argc == 3 && strcmp(argv[1], "-gdb") == 0) { //DIS-Emulator -gdb <port>, debug the program from GDB instead
+        GdbStub<CPU> stub(cpu, mem);
+        stub.Serve((Word)atoi(argv[2]));
+    }
+    else {
+        cpu.Execute(129, mem); //This simply increment loop takes 129 cycles x_x (JRN eats up 6 cycles)
+    }
     cpu.CoreDump();
-
-    __noop; //For breakpoint debugging
 }
@@ -0,0 +1,350 @@
+#pragma once
+#include <string>
+#include "cpu.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// Block device with a DMA engine that moves data between a memory mapped host file and Memory, so the guest never copies it
+/// byte by byte and the host does a single memcpy per transfer.
+///  - The guest programs the Word registers at REGISTERS with ordinary stores and writes a command last. The host calls
+///    Service between Execute calls, which takes the command (COMMAND reads back as CMD_NONE), finishes the transfers that
+///    are due and updates STATUS. STATUS is only meaningful once the command was taken
+///  - A transfer takes latency + length / bytesPerCycle cycles of CPU::Now, one at a time. Its data is copied when it
+///    finishes, then the interrupt is raised. Do not touch the memory of a transfer before that
+///  - CMD_STREAM double buffers: two buffers of LENGTH bytes at MEMORY and MEMORY + LENGTH are filled in turn with
+///    consecutive parts of the file. The guest works on the current buffer (STATUS_BUFFER) and writes CMD_NEXT to hand it
+///    back, which refills it while the other one is used. The interrupt is raised whenever the current buffer is ready
+///  - Finished transfers go through the CPU like a block instruction: ExecutionHistory saves the pages first, the TraceRecorder
+///    attaches the block to the next record and the Debugger sees the access on watched pages. Register updates go through
+///    BeforeWrite and Watch the same way
+///  - The data and register values the guest sees depend on when the host calls Service. They are logged in the CPU's
+///    InputLog while it records, replaying the log re-applies them at the same times and Service does nothing meanwhile
+/// </summary>
+struct BlockDevice
+{
+    static constexpr Word REGISTERS = 0xFFE0; //16 bytes right below Memory::INTERRUPT_TABLE, keep the stack away from them
+
+    //Offsets of the Word registers from REGISTERS
+    enum Register : Word {
+        REG_COMMAND = 0,        //Written by the guest, cleared by the device when it takes the command
+        REG_STATUS = 2,
+        REG_FILE_LOW = 4,       //Byte position in the file
+        REG_FILE_HIGH = 6,
+        REG_MEMORY = 8,         //Guest address, of the first buffer for CMD_STREAM
+        REG_LENGTH = 10,        //Bytes, per buffer for CMD_STREAM
+        REG_TRANSFERRED = 12,   //Bytes the finished transfer (or the current buffer) holds, short at the end of the file
+    };
+    enum Command : Word {
+        CMD_NONE,
+        CMD_READ,               //File to memory
+        CMD_WRITE,              //Memory to file, the file does not grow
+        CMD_STREAM,             //Starts filling both buffers from the file position
+        CMD_NEXT,               //Hands the current buffer back to be refilled, the other one becomes current
+        CMD_STOP,               //Ends the stream, fills still in flight are dropped
+    };
+    enum Status : Word {
+        STATUS_BUSY = 1 << 0,   //A transfer is in flight
+        STATUS_READY = 1 << 1,  //The transfer finished, or the current buffer is filled
+        STATUS_BUFFER = 1 << 2, //Current buffer, 0 is at MEMORY and 1 at MEMORY + LENGTH
+        STATUS_END = 1 << 3,    //The data ends inside this transfer or buffer
+        STATUS_ERROR = 1 << 4,  //Invalid command, or CMD_READ/CMD_WRITE/CMD_STREAM while busy. Cleared by the next command
+    };
+
+    Interrupt interrupt = I_1;  //Raised when a transfer finishes, 0 for a guest that polls STATUS
+    Byte id = 0;                //Device number in the InputLog
+    uint64_t latency = 64;      //Cycles before the first byte moves
+    uint64_t bytesPerCycle = 8;
+
+    uint64_t transfers = 0;
+    uint64_t bytesTransferred = 0;
+
+    BlockDevice() = default;
+    BlockDevice(const BlockDevice&) = delete;
+    BlockDevice& operator=(const BlockDevice&) = delete;
+    ~BlockDevice() {
+        Close();
+    }
+
+    bool Open(const std::string& filename, bool writable = false) {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ | (writable ? GENERIC_WRITE : 0), FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER fileSize;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+            Close();
+            return false;
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        if (size != 0) {
+            mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+            data = mapping == nullptr ? nullptr : static_cast<Byte*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+            if (data == nullptr) {
+                Close();
+                return false;
+            }
+        }
+#else
+        file = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+        struct stat info;
+        if (file < 0 || fstat(file, &info) != 0) {
+            Close();
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size != 0) {
+            void* view = mmap(nullptr, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, file, 0);
+            if (view == MAP_FAILED) {
+                Close();
+                return false;
+            }
+            data = static_cast<Byte*>(view);
+            madvise(data, size, MADV_SEQUENTIAL);
+        }
+#endif
+        this->writable = writable;
+        return true;
+    }
+    void Close() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) {
+            munmap(data, size);
+        }
+        if (file >= 0) {
+            close(file);
+        }
+        file = -1;
+#endif
+        data = nullptr;
+        size = 0;
+        single = {};
+        buffers[0] = buffers[1] = {};
+        streaming = false;
+    }
+    size_t Size() const {
+        return size;
+    }
+
+    //Takes a new command, finishes the transfers that are due and raises the interrupt for them
+    template<typename CPU>
+    void Service(CPU& cpu, Memory& mem) {
+        if (cpu.inputLog != nullptr && cpu.inputLog->Replaying()) {
+            return; //The CPU copies the logged writes in
+        }
+        uint64_t now = cpu.Now();
+        Word command = ReadRegister(mem, REG_COMMAND);
+        if (command != CMD_NONE) {
+            WriteRegister(cpu, mem, REG_COMMAND, CMD_NONE);
+            Start(command, mem, now);
+        }
+
+        bool raise = false;
+        if (single.state == FILLING && single.done <= now) {
+            Finish(cpu, single, mem);
+            raise = true;
+        }
+        for (Byte i = 0; i < 2; i++) {
+            if (buffers[i].state == FILLING && buffers[i].done <= now) {
+                Finish(cpu, buffers[i], mem);
+                raise |= i == current; //The other buffer is announced when it becomes current
+            }
+        }
+        raise |= announce && buffers[current].state == FILLED;
+        announce = false;
+
+        WriteRegister(cpu, mem, REG_STATUS, CurrentStatus());
+        WriteRegister(cpu, mem, REG_TRANSFERRED, streaming ? buffers[current].bytes : single.bytes);
+        if (raise && interrupt != 0) {
+            cpu.SetInterrupt(interrupt);
+        }
+    }
+
+private:
+    enum State : Byte {
+        EMPTY,
+        FILLING,
+        FILLED,
+    };
+    struct Transfer {
+        State state = EMPTY;
+        bool write = false;
+        uint64_t done = 0;      //CPU::Now when it finishes
+        size_t position = 0;    //In the file
+        Word address = 0;
+        Word bytes = 0;         //Clipped to the end of the file
+        bool end = false;       //Clipped, or exactly reached the end of the file
+    };
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int file = -1;
+#endif
+    Byte* data = nullptr;
+    size_t size = 0;
+    bool writable = false;
+
+    Transfer single;
+    Transfer buffers[2];
+    bool streaming = false;
+    Byte current = 0;
+    bool announce = false;      //CMD_NEXT made an already filled buffer current
+    size_t streamPosition = 0;  //Where the next buffer fill reads from
+    Word streamBase = 0;
+    Word streamLength = 0;
+    uint64_t engineFree = 0;    //Transfers run one after another
+    bool error = false;
+
+    static Word ReadRegister(const Memory& mem, Word reg) {
+        return mem[REGISTERS + reg] | (mem[REGISTERS + reg + 1] << 8);
+    }
+    //Service rewrites STATUS and TRANSFERRED every time, only changes are written and logged
+    template<typename CPU>
+    void WriteRegister(CPU& cpu, Memory& mem, Word reg, Word value) {
+        if (ReadRegister(mem, reg) == value) {
+            return;
+        }
+        Word address = REGISTERS + reg;
+        i64 unused = 0; //Outside Execute there is no budget for a watchpoint to end
+        cpu.BeforeWrite(mem, address, 2);
+        mem[address] = value & 0xFF;
+        mem[address + 1] = value >> 8;
+        Record(cpu, mem, address, 2);
+        cpu.Watch(unused, mem, address, 2, Memory::PAGE_WATCH_WRITE | Memory::PAGE_BREAKPOINT);
+    }
+    template<typename CPU>
+    void Record(CPU& cpu, const Memory& mem, Word address, DWord bytes) {
+        if (cpu.inputLog != nullptr) {
+            cpu.inputLog->RecordWrite(cpu.Now(), id, mem, address, bytes);
+        }
+    }
+
+    bool Busy() const {
+        return single.state == FILLING || buffers[0].state == FILLING || buffers[1].state == FILLING;
+    }
+    Word CurrentStatus() const {
+        const Transfer& transfer = streaming ? buffers[current] : single;
+        Word status = 0;
+        status |= Busy() ? STATUS_BUSY : 0;
+        status |= transfer.state == FILLED ? STATUS_READY : 0;
+        status |= streaming && current == 1 ? STATUS_BUFFER : 0;
+        status |= transfer.state == FILLED && transfer.end ? STATUS_END : 0;
+        status |= error ? STATUS_ERROR : 0;
+        return status;
+    }
+
+    void Start(Word command, const Memory& mem, uint64_t now) {
+        error = false;
+        size_t position = ReadRegister(mem, REG_FILE_LOW) | (static_cast<size_t>(ReadRegister(mem, REG_FILE_HIGH)) << 16);
+        Word address = ReadRegister(mem, REG_MEMORY);
+        Word length = ReadRegister(mem, REG_LENGTH);
+
+        switch (command)
+        {
+        case CMD_READ:
+        case CMD_WRITE:
+            if (Busy() || (command == CMD_WRITE && !writable)) {
+                error = true;
+                return;
+            }
+            streaming = false;
+            Schedule(single, command == CMD_WRITE, position, address, length, now);
+            return;
+        case CMD_STREAM:
+            if (Busy()) {
+                error = true;
+                return;
+            }
+            streaming = true;
+            current = 0;
+            streamPosition = position;
+            streamBase = address;
+            streamLength = length;
+            single = {};
+            for (Byte i = 0; i < 2; i++) {
+                Schedule(buffers[i], false, streamPosition, static_cast<Word>(streamBase + i * streamLength), streamLength, now);
+                streamPosition += buffers[i].bytes;
+            }
+            return;
+        case CMD_NEXT:
+            if (!streaming || buffers[current].state != FILLED) {
+                error = true;
+                return;
+            }
+            Schedule(buffers[current], false, streamPosition, buffers[current].address, streamLength, now);
+            streamPosition += buffers[current].bytes;
+            current ^= 1;
+            announce = true;
+            return;
+        case CMD_STOP:
+            if (!streaming) {
+                error = true;
+                return;
+            }
+            streaming = false;
+            buffers[0] = buffers[1] = {};
+            engineFree = now;
+            return;
+        default:
+            error = true;
+            return;
+        }
+    }
+    void Schedule(Transfer& transfer, bool write, size_t position, Word address, Word length, uint64_t now) {
+        transfer.state = FILLING;
+        transfer.write = write;
+        transfer.position = position;
+        transfer.address = address;
+        transfer.bytes = static_cast<Word>(position >= size ? 0 : std::min<size_t>(length, size - position));
+        transfer.end = position + length >= size;
+        engineFree = std::max(engineFree, now) + latency + transfer.bytes / std::max<uint64_t>(bytesPerCycle, 1);
+        transfer.done = engineFree;
+    }
+    template<typename CPU>
+    void Finish(CPU& cpu, Transfer& transfer, Memory& mem) {
+        //Memory wraps past 0xFFFF, a Word length wraps at most once
+        if (transfer.bytes != 0) {
+            size_t first = std::min<size_t>(transfer.bytes, Memory::MEM_SIZE - transfer.address);
+            Byte* file = data + transfer.position;
+            i64 unused = 0; //Outside Execute there is no budget for a watchpoint to end
+            if (transfer.write) {
+                memcpy(file, &mem.Data[transfer.address], first);
+                memcpy(file + first, mem.Data, transfer.bytes - first);
+                cpu.Watch(unused, mem, transfer.address, transfer.bytes, Memory::PAGE_WATCH_READ);
+            }
+            else {
+                cpu.BeforeWrite(mem, transfer.address, transfer.bytes);
+                memcpy(&mem.Data[transfer.address], file, first);
+                memcpy(mem.Data, file + first, transfer.bytes - first);
+                Record(cpu, mem, transfer.address, transfer.bytes);
+                cpu.TraceBlock(transfer.address, transfer.bytes);
+                cpu.Watch(unused, mem, transfer.address, transfer.bytes, Memory::PAGE_WATCH_WRITE | Memory::PAGE_BREAKPOINT);
+            }
+        }
+        transfer.state = FILLED;
+        transfers++;
+        bytesTransferred += transfer.bytes;
+    }
+};
@@ -1,5 +1,12 @@
 #pragma once
 #include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 typedef uint8_t Byte;
 typedef uint16_t Word;
@@ -13,13 +20,17 @@ typedef int64_t i64;
 ///  - All memory operations are 16 bit
 ///  - In progmem, all values are stored as 16 bits except register and interrupt values which are stored in 8 bits
 ///  - The addressing mode bit is 0 for constant memory access and 1 for register value access (excluding logical jumps)
-///  - The addressing mode bit determines if the new PC value is read from a constant or a register in logical jumps
+///  - The addressing mode bit determines if the new PC value is read from a constant or a register in logical jumps and JSR
+///  - Indirect jumps (JMPI/JSRI) read the new PC value from memory, the addressing mode bit applies to the memory address
+///  - Short form ("S"/"B" suffix) opcodes ignore the addressing mode bit. Branch targets are a signed 8 bit displacement
+///    from the end of the instruction and immediates are an unsigned 8 bit value
 /// </summary>
 
 enum Opcode : Byte
 {
     //Special
     OP_NOOP = 0x00,     //No Op
+    OP_BRK = 0x7D,      //Breakpoint patched in by the Debugger, illegal anywhere else
     OP_RESET = 0x7E,    //Reset the CPU (clears registers and memory, resets flags)
     OP_HALT = 0x7F,     //Stops the CPU execution of instuctions
 
@@ -36,8 +47,13 @@ enum Opcode : Byte
     OP_DIV,             //Divide two registers, store in first
     OP_DIVC,            //Divide constant value from a register, store in register
 
-    //OP_CMP = 0x0E,      //Subtract two registers and update status flags, discard result
-    //OP_CMPA = 0x0F,     //Subtract a value in memory from a register and update status flags, discard result
+    OP_ADDCB,           //Add byte constant into register
+    OP_SUBCB,           //Subtract byte constant from a register, store in register
+
+    OP_CMPC,            //Subtract a constant from a register and update status flags, discard result
+    OP_CMPCB,           //Subtract a byte constant from a register and update status flags, discard result
+    OP_CMP = 0x0E,      //Subtract two registers and update status flags, discard result
+    OP_CMPA = 0x0F,     //Subtract a value in memory from a register and update status flags, discard result
 
     //Increment
     OP_INC = 0x10,      //Increment a value in a register
@@ -47,6 +63,19 @@ enum Opcode : Byte
     OP_UXT = 0x20,      //Zero extend a register (truncate 16 bit value to 8 bits)
     OP_LSL,             //Logical shift left
     OP_LSR,             //Logical shift right
+    OP_LSLR,            //Logical shift left by a register count
+    OP_LSRR,            //Logical shift right by a register count
+    OP_ROL,             //Rotate left
+    OP_ROLR,            //Rotate left by a register count
+    OP_ROR,             //Rotate right
+    OP_RORR,            //Rotate right by a register count
+    OP_AND,             //Bitwise AND two registers, store in first
+    OP_ANDC,            //Bitwise AND a constant into a register
+    OP_OR,              //Bitwise OR two registers, store in first
+    OP_ORC,             //Bitwise OR a constant into a register
+    OP_XOR,             //Bitwise XOR two registers, store in first
+    OP_XORC,            //Bitwise XOR a constant into a register
+    OP_NOT,             //Bitwise NOT a register
 
     //Data moving
     OP_LDR = 0x30,      //Load value from second register into first register
@@ -56,8 +85,15 @@ enum Opcode : Byte
     OP_STRM,            //Store register into memory
     OP_STCM,            //Store constant into memory
 
+    OP_LDCB,            //Load byte constant into register
+
+    //Block memory (register operands: destination, source/value, length in words)
+    OP_BMOV = 0x38,     //Copy a block of words, overlapping blocks are handled like memmove
+    OP_BSET,            //Fill a block of words with a register value
+    OP_BCMP,            //Compare two blocks of words, stops at the first difference and updates status flags like CMP
+
     //Control
-    OP_JSR = 0x40,      //Increment SP by 2, push the current PC to the stack, and jump to a subroutine
+    OP_JSR = 0x40,      //Decrement SP by 2, push the current PC to the stack, and jump to a subroutine (constant or register)
     OP_RTN,             //Pop the previous PC off the stack and jump to it, decrement value
 
     OP_JMP,             //Jump to a constant address (set program counter) and continue execution
@@ -69,14 +105,27 @@ enum Opcode : Byte
     OP_JRGE,            //Jump to a constant address if register is >= to a constant value
     OP_JRLE,            //Jump to a constant address if register is <= to a constant value
 
-    //OP_JMPR,             //Set the program counter to a register value and continue execution
-    //OP_JRZR,             //Set the program counter to a register value if register is = to 0
-    //OP_JRER,             //Set the program counter to a register value if register is = to a constant value
-    //OP_JRNR,             //Set the program counter to a register value if register is != to a constant value
-    //OP_JRGR,             //Set the program counter to a register value if register is > than a constant value
-    //OP_JRLR,             //Set the program counter to a register value if register is < than a constant value
-    //OP_JRGER,            //Set the program counter to a register value if register is >= to a constant value
-    //OP_JRLER,            //Set the program counter to a register value if register is <= to a constant value
+    OP_JMPS = 0x50,     //Jump to a PC relative address
+    OP_JRZS,            //Jump to a PC relative address if register is = to 0
+    OP_JRES,            //Jump to a PC relative address if register is = to a constant value
+    OP_JRNS,            //Jump to a PC relative address if register is != to a constant value
+    OP_JRGS,            //Jump to a PC relative address if register is > than a constant value
+    OP_JRLS,            //Jump to a PC relative address if register is < than a constant value
+    OP_JRGES,           //Jump to a PC relative address if register is >= to a constant value
+    OP_JRLES,           //Jump to a PC relative address if register is <= to a constant value
+
+    //Flag branches, always a PC relative displacement. Opposite conditions only differ in the lowest bit
+    OP_BEQ = 0x58,      //Branch if zero flag is set (equal after CMP)
+    OP_BNE,             //Branch if zero flag is clear (not equal after CMP)
+    OP_BLT,             //Branch if negative flag != overflow flag (signed less than after CMP)
+    OP_BGE,             //Branch if negative flag == overflow flag (signed greater or equal after CMP)
+    OP_BCS,             //Branch if carry flag is set (unsigned less than after CMP)
+    OP_BCC,             //Branch if carry flag is clear (unsigned greater or equal after CMP)
+    OP_BVS,             //Branch if overflow flag is set
+    OP_BVC,             //Branch if overflow flag is clear
+
+    OP_JMPI = 0x4B,     //Jump to an address read from memory (jump tables)
+    OP_JSRI,            //Jump to a subroutine whose address is read from memory
 
     //Stack
     OP_PUSH = 0x60,     //Push register onto stack, decrement SP by (opsize + 1)
@@ -87,8 +136,19 @@ enum Opcode : Byte
     OP_PUSHS,           //Push status onto stack, decrement SP by (opsize + 1)
     OP_POPS,            //Pop stack into status, increment SP by (opsize + 1)
 
+    OP_PUSHCB,          //Push byte constant onto stack as a word, decrement SP by (opsize + 1)
+
     OP_SEI = 0x70,      //Set the global interrupt enable flag
     OP_CLI,             //Clear the global interrupt enable flag
+    OP_WAIT,            //Wait until an interrupt is raised, the rest of the budget passes idle meanwhile
+
+    //Counters, read as they were before the instruction into two registers (high word, low word)
+    OP_RDCYC = 0x73,    //Bits 0-31 of the cycle counter, CPU::Now (instructions and interrupt entries without CycleExact)
+    OP_RDCYCH,          //Bits 32-63 of the cycle counter
+    OP_RDINST,          //Bits 0-31 of the retired instruction counter, CPU::retired
+    OP_RDINSTH,         //Bits 32-63 of the retired instruction counter
+
+    OP_RTI = 0x77,      //Return from interrupt: pop the PC, then the status. Interrupts are re-enabled only once the handler has returned
 
     //Opcodes must not excede 0x7F (01111111) due to the "addressMode" bit!
 };
@@ -125,14 +185,37 @@ struct Memory
         +-----------------+ 0x0000
     */
 
-    static constexpr Word MEM_SIZE = 0xFFFF;
+    static constexpr DWord MEM_SIZE = 0x10000; //Every 16 bit address is backed, accesses past 0xFFFF wrap to 0x0000
     static constexpr Word INTERRUPT_TABLE = 0xFFF0;
+    static constexpr DWord PAGE_SIZE = 256;
+    static constexpr DWord PAGE_COUNT = MEM_SIZE / PAGE_SIZE;
+
+    //Set by the Debugger. CPU data accesses to a flagged page are reported to it, unflagged pages cost a single test
+    enum PageFlags : Byte {
+        PAGE_WATCH_READ = 1 << 0,
+        PAGE_WATCH_WRITE = 1 << 1,
+        PAGE_BREAKPOINT = 1 << 2,   //Holds a patched OP_BRK, writes are reported so the breakpoint survives them
+    };
 
     Byte Data[MEM_SIZE];
+    Byte pageFlags[PAGE_COUNT] = {};
 
     void Clear() {
         memset(Data, 0, MEM_SIZE);
     }
+    //True if any page of the range has one of flags
+    bool Flagged(Word address, DWord bytes, Byte flags) const {
+        if (bytes <= PAGE_SIZE) { //Touches at most two pages
+            return ((pageFlags[address / PAGE_SIZE] | pageFlags[(Word)(address + bytes - 1) / PAGE_SIZE]) & flags) != 0;
+        }
+        DWord pages = bytes >= MEM_SIZE ? PAGE_COUNT : ((address % PAGE_SIZE) + bytes - 1) / PAGE_SIZE + 1;
+        for (DWord i = 0; i < pages; i++) {
+            if (pageFlags[(Byte)(address / PAGE_SIZE + i)] & flags) { //Wraps past the end of memory
+                return true;
+            }
+        }
+        return false;
+    }
 
     Byte operator[](Word address) const {
         return Data[address];
@@ -184,84 +267,279 @@ union Registers //Not including special registers
         return aligned[reg];
     }
 };
-struct CPU {
+#include "isa.h"
+#include "profiler.h"
+#include "trace.h"
+#include "replay.h"
+#include "history.h"
+#include "debugger.h"
+
+/// <summary>
+/// Compile time configuration of BasicCPU. Derive from CPUPolicy and override the flags a deployment does not need,
+/// disabled features are removed from Execute with "if constexpr" instead of being checked at runtime
+/// </summary>
+struct CPUPolicy
+{
+    static constexpr bool Interrupts = true;    //Poll the interrupt flags before every instruction
+    static constexpr bool CycleExact = true;    //true: the Execute budget is in cycles. false: it is in instructions and no cycles are counted
+#ifdef DIS_PROFILER
+    static constexpr bool Profiling = true;     //Call the attached Profiler after every instruction
+#else
+    static constexpr bool Profiling = false;
+#endif
+#ifdef DIS_TRACE
+    static constexpr bool Tracing = true;       //Record every instruction into the attached TraceRecorder
+#else
+    static constexpr bool Tracing = false;
+#endif
+    static constexpr bool ReverseExecution = true; //Checkpoint into the attached ExecutionHistory
+    static constexpr bool Debugging = true;     //Breakpoints and watchpoints of the attached Debugger
+    static constexpr bool FastForward = true;   //Skip whole iterations of idle and counting loops in closed form
+    static constexpr bool StrictChecks = true;  //true: bad register indices and illegal opcodes throw. false: indices are masked to 0-7 and illegal opcodes halt
+    static constexpr bool Logging = true;       //Console messages on HALT, RESET and budget overruns
+};
+//Guests that never use interrupts and only need an instruction budget
+struct FastCPUPolicy : CPUPolicy
+{
+    static constexpr bool Interrupts = false;
+    static constexpr bool CycleExact = false;
+    static constexpr bool Profiling = false;
+    static constexpr bool Tracing = false;
+    static constexpr bool ReverseExecution = false;
+    static constexpr bool Debugging = false;
+    static constexpr bool StrictChecks = false;
+    static constexpr bool Logging = false;
+};
+
+template<typename Policy>
+struct BasicCPU {
+    //Block instructions charge a fixed cost per word instead of the per byte cost of LDM/STRM loops
+    static constexpr i64 BLOCK_MOVE_CYCLES_PER_WORD = 2; //BMOV and BCMP: one burst read and one burst write/compare
+    static constexpr i64 BLOCK_FILL_CYCLES_PER_WORD = 1; //BSET: one burst write
+    static constexpr Word BLOCK_INSTRUCTION_SIZE = 4; //Opcode and 3 registers
+
     //Registers
     Registers registers;
     bool halted = false;
+    bool waiting = false; //Suspended in WAIT, the host can block in WaitForInterrupt instead of calling Execute
+
+    Profiler* profiler = nullptr; //Optional, owned by the caller. Only used when Policy::Profiling is set
+    TraceRecorder* tracer = nullptr; //Optional, owned by the caller. Only used when Policy::Tracing is set
+    InputLog* inputLog = nullptr; //Optional, owned by the caller. Records or replays interrupts and device writes, requires Policy::Interrupts
+    ExecutionHistory* history = nullptr; //Optional, owned by the caller. Only used when Policy::ReverseExecution is set
+    Debugger* debugger = nullptr; //Optional, owned by the caller. Only used when Policy::Debugging is set
+
+    uint64_t elapsed = 0; //Cycles (instructions without CycleExact) executed by finished Execute calls
+    i64 budget = 0; //Budget of the running Execute call
+    uint64_t retired = 0; //Instructions and interrupt entries executed since construction, the counter RDINST reads
+    std::atomic<Byte> pendingInterrupts{ 0 }; //Raised by SetInterrupt, latched into interruptFlags at the next instruction boundary
+    i64 trapped = 0; //Budget set aside by Trap, given back when Execute returns
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool wakeRequested = false;
+
+    static void Charge(i64& cycles, i64 amount) {
+        if constexpr (Policy::CycleExact) {
+            cycles -= amount;
+        }
+    }
+    Word& Reg(Byte index) {
+        if constexpr (Policy::StrictChecks) {
+            if (index >= 8) {
+                throw std::runtime_error("ERROR: Invalid register index\n");
+            }
+            return registers[index];
+        }
+        else {
+            return registers[index & 7];
+        }
+    }
 
+    //Safe to call from other threads while Execute is running
     void SetInterrupt(Interrupt i) {
-        registers.interruptFlags &= i;
+        pendingInterrupts.fetch_or(i, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(wakeMutex); //Not between WaitForInterrupt's check and its sleep
+        wake.notify_all();
+    }
+    //Blocks the calling thread until an interrupt is raised or Wake is called. Hosts call it while waiting is set
+    //instead of spinning on Execute, the guest cannot make progress until then. WAIT only suspends with interruptFlags
+    //empty, so only the interrupts raised by SetInterrupt since then are checked
+    void WaitForInterrupt() {
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait(lock, [this] {
+            return pendingInterrupts.load(std::memory_order_acquire) != 0 || wakeRequested;
+        });
+        wakeRequested = false;
+    }
+    //Releases WaitForInterrupt without an interrupt, to stop the host thread
+    void Wake() {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wakeRequested = true;
+        wake.notify_all();
+    }
+    //Host loop for a runner thread: executes slices of the given budget and sleeps in WaitForInterrupt while the guest waits.
+    //Returns when the guest halts or stop is set, another thread stops it by setting stop and then calling Wake
+    void RunUntilStopped(i64 slice, Memory& mem, const std::atomic<bool>& stop) {
+        while (!halted && !stop.load(std::memory_order_acquire)) {
+            if (waiting) {
+                WaitForInterrupt();
+                if (stop.load(std::memory_order_acquire)) {
+                    break;
+                }
+            }
+            Execute(slice, mem); //Delivers the interrupt that ended the wait
+        }
+    }
+
+    //Time used by InputLog and the cycle counter RDCYC reads. Execute's remaining budget is needed while it runs
+    uint64_t Now() const {
+        return elapsed;
+    }
+    uint64_t Now(i64 cycles) const {
+        return elapsed + (budget - cycles);
     }
 
     void Reset(Memory& mem) {
+        BeforeWrite(mem, 0, Memory::MEM_SIZE);
         mem.Clear();
+        i64 unused = 0;
+        Watch(unused, mem, 0, Memory::MEM_SIZE, Memory::PAGE_BREAKPOINT); //Puts the cleared breakpoints back
 
+        memset(registers.aligned, 0, 6 * sizeof(Word));
         registers.PC = 0;
         registers.SP = 0x00A0; //Stack grows backwards from end
-        memset(registers.aligned, 0, 6);
+        registers.status = 0;
+        registers.interruptFlags = 0;
     }
 
     Byte NextByte(i64& cycles, Memory& mem) {
-        cycles--;
+        Charge(cycles, 1);
         return mem[registers.PC++];
     }
     Byte ReadByte(i64& cycles, Memory& mem, Word address) const {
-        cycles--;
+        Charge(cycles, 1);
         return mem[address];
     }
+    template<bool Watching = false>
     Byte& ReadByte(i64& cycles, Memory& mem, Word address) {
-        cycles--;
+        Charge(cycles, 1);
+        WatchRead<Watching>(cycles, mem, address, 1);
         return mem[address];
     }
+    template<bool Watching = false>
     void WriteByte(i64& cycles, Memory& mem, Word address, Byte value) {
+        BeforeWrite(mem, address, 1);
         mem[address] = value;
-        cycles--;
+        Charge(cycles, 1);
+        TraceWrite(address, value, true);
+        WatchWrite<Watching>(cycles, mem, address, 1);
+    }
+
+    //Reads a signed 8 bit displacement and returns the address it points to, relative to the end of the instruction
+    Word NextRelative(i64& cycles, Memory& mem) {
+        int8_t offset = (int8_t)NextByte(cycles, mem);
+        return registers.PC + offset;
     }
 
     Word NextWord(i64& cycles, Memory& mem) {
         Word word = mem[registers.PC++];
         word |= (mem[registers.PC++] << 8); //Little endian system
 
-        cycles -= 2;
+        Charge(cycles, 2);
         return word;
     }
-    Word ReadWord(i64& cycles, Memory& mem, Word address) const {
+    template<bool Watching = false>
+    Word ReadWord(i64& cycles, Memory& mem, Word address) {
         Word word = mem[address];
         word |= (mem[address + 1] << 8); //Little endian system
 
-        cycles -= 2;
+        Charge(cycles, 2);
+        WatchRead<Watching>(cycles, mem, address, 2);
         return word;
     }
+    template<bool Watching = false>
     void WriteWord(i64& cycles, Memory& mem, Word address, Word value) {
+        BeforeWrite(mem, address, 2);
         mem[address] = value & 0xFF; //Get the lowest 8 bits
         mem[address + 1] = value >> 8; //Get ths highest 8 bits
-        cycles -= 2;
+        Charge(cycles, 2);
+        TraceWrite(address, value, false);
+        WatchWrite<Watching>(cycles, mem, address, 2);
     }
+    template<bool Watching = false>
     void StackPush(i64& cycles, Memory& mem, Word value) {
         registers.SP -= 2;
-        WriteWord(cycles, mem, registers.SP, value);
+        WriteWord<Watching>(cycles, mem, registers.SP, value);
     }
+    template<bool Watching = false>
     Word StackPop(i64& cycles, Memory& mem) {
-        Word value = ReadWord(cycles, mem, registers.SP);
+        Word value = ReadWord<Watching>(cycles, mem, registers.SP);
         registers.SP += 2;
         return value;
     }
 
-    void UpdateStatusFlags(i64 result) {
-        if (result > sizeof(Word)) {
-            registers.C = 1;
+    void BeforeWrite(const Memory& mem, Word address, DWord bytes) {
+        if constexpr (Policy::ReverseExecution) {
+            if (history != nullptr) {
+                history->BeforeWrite(mem, address, bytes, retired);
+            }
         }
-        else {
-            registers.C = 0;
+    }
+    //Data accesses to flagged pages are reported to the Debugger. Execute only compiles the test in while the Debugger has
+    //something armed (see Run). Instruction fetches are never tested, breakpoints are patched in instead
+    void Watch(i64& cycles, Memory& mem, Word address, DWord bytes, Byte flags) {
+        if constexpr (Policy::Debugging) {
+            if (mem.Flagged(address, bytes, flags) && debugger != nullptr && debugger->MemoryAccess(mem, address, bytes, flags)) {
+                Trap(cycles);
+            }
         }
+    }
+    template<bool Watching>
+    void WatchRead(i64& cycles, Memory& mem, Word address, DWord bytes) {
+        if constexpr (Watching) {
+            Watch(cycles, mem, address, bytes, Memory::PAGE_WATCH_READ);
+        }
+    }
+    template<bool Watching>
+    void WatchWrite(i64& cycles, Memory& mem, Word address, DWord bytes) {
+        if constexpr (Watching) {
+            Watch(cycles, mem, address, bytes, Memory::PAGE_WATCH_WRITE | Memory::PAGE_BREAKPOINT);
+        }
+    }
+    //Ends Execute once the current instruction finishes. The loop already stops on an exhausted budget, so the rest of
+    //the budget is set aside instead of testing a stop flag before every instruction
+    void Trap(i64& cycles) {
+        i64 rest = std::max<i64>(cycles, 0);
+        trapped += rest;
+        cycles -= rest;
+    }
 
-        if (result > sizeof(int16_t)) {
-            registers.O = 1;
+    void TraceWrite(Word address, Word value, bool isByte) {
+        if constexpr (Policy::Tracing) {
+            if (tracer != nullptr) {
+                tracer->MemoryWrite(address, value, isByte);
+            }
+        }
+    }
+    void TraceBlock(Word address, DWord bytes) {
+        if constexpr (Policy::Tracing) {
+            if (tracer != nullptr) {
+                tracer->BlockWrite(address, bytes);
+            }
+        }
+    }
+
+    //Carry and overflow come from the caller, negative and zero from the low 16 bits of the result
+    void UpdateStatusFlags(i64 result, bool overflow) {
+        if (result < 0 || result > UINT16_MAX) { //Carry out of an add, borrow out of a subtract
+            registers.C = 1;
         }
         else {
-            registers.O = 0;
+            registers.C = 0;
         }
 
+        registers.O = overflow;
+
         if (result & 32768) { // 1 << 15
             registers.N = 1;
         }
@@ -269,13 +547,181 @@ struct CPU {
             registers.N = 0;
         }
 
-        if (result == 0) {
+        if ((Word)result == 0) {
             registers.Z = 1;
         }
         else {
             registers.Z = 0;
         }
     }
+    //Signed overflow when both operands have the same sign and the result's sign differs
+    Word AddWithFlags(Word a, Word b) {
+        Word result = a + b;
+        UpdateStatusFlags((i64)a + b, (~(a ^ b) & (a ^ result) & 0x8000) != 0);
+        return result;
+    }
+    //Signed overflow when the operands differ in sign and the result's sign differs from a
+    Word SubtractWithFlags(Word a, Word b) {
+        Word result = a - b;
+        UpdateStatusFlags((i64)a - b, ((a ^ b) & (a ^ result) & 0x8000) != 0);
+        return result;
+    }
+    //AND/OR/XOR/NOT set zero and negative from the result and clear carry and overflow
+    void UpdateLogicFlags(Word result) {
+        UpdateStatusFlags(result, false);
+    }
+    //Shifts of 16 or more clear the register, rotates use the count modulo 16
+    static Word ShiftLeft(Word value, Word count) {
+        return count >= 16 ? 0 : (Word)(value << count);
+    }
+    static Word ShiftRight(Word value, Word count) {
+        return count >= 16 ? 0 : (Word)(value >> count);
+    }
+    static Word RotateLeft(Word value, Word count) {
+        count &= 15;
+        return (Word)((value << count) | (value >> ((16 - count) & 15)));
+    }
+    static Word RotateRight(Word value, Word count) {
+        return RotateLeft(value, (16 - (count & 15)) & 15);
+    }
+    //Flags of a - b. Overflow is computed on the signed interpretation of both operands so BLT/BGE are exact
+    void UpdateCompareFlags(Word a, Word b) {
+        SubtractWithFlags(a, b);
+    }
+
+    //Block instructions process as many words as the remaining cycles allow and rewind the PC while words remain,
+    //so long blocks respect the cycle budget and interrupts like a REP prefixed x86 instruction. They return true once finished.
+    //Operand registers must be distinct. The length register counts down to 0 and the address registers advance past the
+    //processed words, except for an overlapping BMOV with destination > source which copies backwards and leaves them unchanged
+    static Word BlockChunk(i64 cycles, Word length, i64 cyclesPerWord) {
+        if constexpr (!Policy::CycleExact) {
+            return length; //Without cycle counting a block is a single instruction
+        }
+        i64 words = std::max<i64>(1, cycles / cyclesPerWord); //Always make progress
+        return (Word)std::min<i64>(words, length);
+    }
+    static bool IsContiguous(Word address, Word words) {
+        return (DWord)address + (DWord)words * 2 <= Memory::MEM_SIZE;
+    }
+    static Word PeekWord(const Memory& mem, Word address) {
+        return mem[address] | (mem[(Word)(address + 1)] << 8);
+    }
+    template<bool Watching = false>
+    bool BlockMove(i64& cycles, Memory& mem, Byte dstReg, Byte srcReg, Byte lengthReg) {
+        Word dst = Reg(dstReg);
+        Word src = Reg(srcReg);
+        Word length = Reg(lengthReg);
+        if (length == 0) {
+            return true;
+        }
+
+        Word words = BlockChunk(cycles, length, BLOCK_MOVE_CYCLES_PER_WORD);
+        DWord distance = (Word)(dst - src);
+        bool backward = distance != 0 && distance < (DWord)length * 2;
+        Word from = backward ? src + (length - words) * 2 : src;
+        Word to = backward ? dst + (length - words) * 2 : dst;
+        BeforeWrite(mem, to, words * 2);
+
+        if (IsContiguous(from, words) && IsContiguous(to, words)) {
+            memmove(&mem.Data[to], &mem.Data[from], words * 2);
+        }
+        else { //Wraps around the end of memory
+            for (DWord i = 0; i < (DWord)words * 2; i++) {
+                DWord offset = backward ? words * 2 - 1 - i : i;
+                mem[(Word)(to + offset)] = mem[(Word)(from + offset)];
+            }
+        }
+
+        Charge(cycles, words * BLOCK_MOVE_CYCLES_PER_WORD);
+        TraceBlock(to, words * 2);
+        WatchRead<Watching>(cycles, mem, from, words * 2);
+        WatchWrite<Watching>(cycles, mem, to, words * 2);
+        Reg(lengthReg) -= words;
+        if (!backward) {
+            Reg(srcReg) += words * 2;
+            Reg(dstReg) += words * 2;
+        }
+        return Reg(lengthReg) == 0;
+    }
+    template<bool Watching = false>
+    bool BlockFill(i64& cycles, Memory& mem, Byte dstReg, Byte valueReg, Byte lengthReg) {
+        Word dst = Reg(dstReg);
+        Word value = Reg(valueReg);
+        Word length = Reg(lengthReg);
+        if (length == 0) {
+            return true;
+        }
+
+        Word words = BlockChunk(cycles, length, BLOCK_FILL_CYCLES_PER_WORD);
+        Byte low = value & 0xFF;
+        Byte high = value >> 8;
+        BeforeWrite(mem, dst, words * 2);
+
+        if (IsContiguous(dst, words) && low == high) {
+            memset(&mem.Data[dst], low, words * 2);
+        }
+        else if (IsContiguous(dst, words)) {
+            //Write one word, then keep doubling the filled region
+            mem.Data[dst] = low;
+            mem.Data[dst + 1] = high;
+            for (DWord filled = 2; filled < (DWord)words * 2; filled *= 2) {
+                memcpy(&mem.Data[dst + filled], &mem.Data[dst], std::min<DWord>(filled, words * 2 - filled));
+            }
+        }
+        else {
+            for (Word i = 0; i < words; i++) {
+                mem[(Word)(dst + i * 2)] = low;
+                mem[(Word)(dst + i * 2 + 1)] = high;
+            }
+        }
+
+        Charge(cycles, words * BLOCK_FILL_CYCLES_PER_WORD);
+        TraceBlock(dst, words * 2);
+        WatchWrite<Watching>(cycles, mem, dst, words * 2);
+        Reg(lengthReg) -= words;
+        Reg(dstReg) += words * 2;
+        return Reg(lengthReg) == 0;
+    }
+    template<bool Watching = false>
+    bool BlockCompare(i64& cycles, Memory& mem, Byte aReg, Byte bReg, Byte lengthReg) {
+        Word a = Reg(aReg);
+        Word b = Reg(bReg);
+        Word length = Reg(lengthReg);
+        if (length == 0) {
+            UpdateCompareFlags(0, 0); //Empty blocks are equal
+            return true;
+        }
+
+        Word words = BlockChunk(cycles, length, BLOCK_MOVE_CYCLES_PER_WORD);
+        Word equalWords = words;
+        if (!IsContiguous(a, words) || !IsContiguous(b, words) || memcmp(&mem.Data[a], &mem.Data[b], words * 2) != 0) {
+            for (equalWords = 0; equalWords < words; equalWords++) {
+                if (PeekWord(mem, a + equalWords * 2) != PeekWord(mem, b + equalWords * 2)) {
+                    break;
+                }
+            }
+        }
+
+        bool mismatch = equalWords < words;
+        Word compared = mismatch ? equalWords + 1 : words;
+        Charge(cycles, compared * BLOCK_MOVE_CYCLES_PER_WORD);
+        WatchRead<Watching>(cycles, mem, a, compared * 2);
+        WatchRead<Watching>(cycles, mem, b, compared * 2);
+        Reg(lengthReg) -= equalWords;
+        Reg(aReg) += equalWords * 2; //Left on the first differing word
+        Reg(bReg) += equalWords * 2;
+
+        if (mismatch) {
+            UpdateCompareFlags(PeekWord(mem, Reg(aReg)), PeekWord(mem, Reg(bReg)));
+            return true;
+        }
+        if (Reg(lengthReg) == 0) {
+            UpdateCompareFlags(0, 0);
+            return true;
+        }
+        return false;
+    }
+
     void CoreDump() const {
         printf("\nCPU CORE DUMP:\n");
 
@@ -299,29 +745,227 @@ struct CPU {
         printf("Unused flag:        %i\n", registers._);
     }
 
-    void ExecuteInterrupt(i64& cycles, Memory& mem, Interrupt i) {
-        StackPush(cycles, mem, registers.status);
-        StackPush(cycles, mem, registers.PC);
+    //index is the interrupt number, 0-6 or 7 for the high priority interrupt
+    template<bool Watching = false>
+    void ExecuteInterrupt(i64& cycles, Memory& mem, Byte index) {
+        if constexpr (Policy::Interrupts) {
+            if (inputLog != nullptr && !inputLog->Replaying()) {
+                inputLog->RecordInterrupt(Now(cycles), index);
+            }
+        }
+
+        if (waiting) {
+            registers.PC++; //Return past the WAIT
+            waiting = false;
+        }
+
+        Word startPC = registers.PC;
+        i64 startCycles = cycles;
+        StackPush<Watching>(cycles, mem, registers.status);
+        StackPush<Watching>(cycles, mem, registers.PC);
 
-        registers.PC = ReadWord(cycles, mem, Memory::INTERRUPT_TABLE + (i * 2));
+        registers.PC = ReadWord<Watching>(cycles, mem, Memory::INTERRUPT_TABLE + (index * 2));
         registers.I = 0; //Disable low priority interrupts from interrupting this routine
-        registers.interruptFlags &= ~(1 << i); //Clear the flag for this interrupt
+        registers.interruptFlags &= ~(1 << index); //Clear the flag for this interrupt
+
+        if constexpr (Policy::Profiling) {
+            if (profiler != nullptr) {
+                profiler->RecordInterrupt(startCycles - cycles, registers.PC);
+            }
+        }
+        if constexpr (Policy::Tracing) {
+            if (tracer != nullptr) {
+                tracer->Retire(TraceRecord::INTERRUPT, startPC, index, startCycles - cycles, registers);
+            }
+        }
+    }
+    //Delivers at most one interrupt at an instruction boundary, returns true if one was taken
+    template<bool Watching = false>
+    bool PollInterrupts(i64& cycles, Memory& mem) {
+        if (inputLog != nullptr && inputLog->Replaying()) {
+            pendingInterrupts.store(0, std::memory_order_relaxed); //Live interrupts are replaced by the logged ones
+            inputLog->ReplayWrites(*this, cycles, mem, Now(cycles));
+            int index = inputLog->ReplayInterrupt(Now(cycles));
+            if (index < 0) {
+                return false;
+            }
+            ExecuteInterrupt<Watching>(cycles, mem, (Byte)index);
+            return true;
+        }
+
+        if (pendingInterrupts.load(std::memory_order_relaxed) != 0) {
+            registers.interruptFlags |= pendingInterrupts.exchange(0, std::memory_order_acquire);
+        }
+
+        //Is high priority interrupt flag set?
+        if (registers.interruptFlags & I_NM) {
+            ExecuteInterrupt<Watching>(cycles, mem, 7);
+            return true;
+        }
+        Byte lowPriority = registers.interruptFlags & ~I_NM;
+        if (registers.I && lowPriority != 0) {
+            Byte index = 0;
+            while ((lowPriority & (1 << index)) == 0) {
+                index++;
+            }
+            ExecuteInterrupt<Watching>(cycles, mem, index);
+            return true;
+        }
+        return false;
+    }
+    //Iterations until a counter stepping by step (+1 or -1) from value makes condition false, the last one included.
+    //0 if it never does. The taken sets of the unsigned compares are intervals, != is the only one that wraps around
+    static DWord IterationsToExit(Word value, int step, Opcode condition, Word constant) {
+        Word first = value + step;
+        DWord low = 0;
+        DWord high = UINT16_MAX;
+        switch (condition)
+        {
+        case OP_JRZ: case OP_JRZS: low = high = 0; break;
+        case OP_JRE: case OP_JRES: low = high = constant; break;
+        case OP_JRN: case OP_JRNS: return (Word)((constant - first) * step) + 1;
+        case OP_JRG: case OP_JRGS: low = (DWord)constant + 1; break;
+        case OP_JRGE: case OP_JRGES: low = constant; break;
+        case OP_JRL: case OP_JRLS:
+            if (constant == 0) {
+                return 1;
+            }
+            high = constant - 1;
+            break;
+        case OP_JRLE: case OP_JRLES: high = constant; break;
+        default: return 1;
+        }
+        if (first < low || first > high) {
+            return 1;
+        }
+        if (low == 0 && high == UINT16_MAX) {
+            return 0;
+        }
+        return step > 0 ? high - first + 2 : first - low + 2;
+    }
+    //Called after a jump to an address at or before itself. Two loop shapes have no side effects besides their counter:
+    //  - A jump to itself, idle until an interrupt (JMP, JMPS, or a taken JRx whose register cannot change)
+    //  - INC or DEC of a register directly followed by a JRx on it back to the INC/DEC
+    //Whole iterations are applied at once while they leave budget for the next instruction, like the interpreter would
+    //run them. The rest (the exit iteration or the one the budget ends in) is interpreted as usual. Stops short of
+    //the next replayed interrupt and does nothing while an interrupt is deliverable, but interrupts raised by other threads
+    //during skipped iterations are only seen at the next instruction boundary after them
+    void FastForward(i64& cycles, Memory& mem, Word jumpPC, i64 jumpCycles) {
+        if (profiler != nullptr || tracer != nullptr || history != nullptr) {
+            return; //They need every instruction
+        }
+        Byte instByte = mem[jumpPC];
+        Opcode jump = (Opcode)(instByte & 0x7F);
+        bool registerAddress = (instByte >> 7) == 1;
+        bool shortForm = jump >= OP_JMPS && jump <= OP_JRLES;
+        if (!(jump >= OP_JMP && jump <= OP_JRLE) && !shortForm) {
+            return;
+        }
+        if (registerAddress && !shortForm) {
+            return; //The target register could be the counter
+        }
+
+        Word next = jumpPC + 1; //Operands
+        Byte counter = 0xFF;
+        Word constant = 0;
+        if (jump != OP_JMP && jump != OP_JMPS) {
+            counter = mem[next++];
+            if (jump != OP_JRZ && jump != OP_JRZS) {
+                constant = PeekWord(mem, next);
+                next += 2;
+            }
+        }
+        Word target = shortForm ? (Word)(next + 1 + (int8_t)mem[next]) : PeekWord(mem, next);
+        Word fallThrough = next + (shortForm ? 1 : 2);
+        if (registers.PC != target || target == fallThrough) {
+            return;
+        }
+
+        i64 cost = jumpCycles - cycles;
+        i64 instructions = 1;
+        DWord exit = 0;
+        if (target != jumpPC) {
+            Opcode step = (Opcode)(mem[target] & 0x7F);
+            if (counter >= 6 || target != (Word)(jumpPC - 2) || (step != OP_INC && step != OP_DEC) || mem[(Word)(target + 1)] != counter) {
+                return; //Only R0-R5, PC and SP change on their own
+            }
+            cost += Policy::CycleExact ? 2 : 1;
+            instructions = 2;
+            exit = IterationsToExit(registers[counter], step == OP_INC ? 1 : -1, jump, constant);
+        }
+
+        i64 iterations = cycles > 0 ? (cycles - 1) / cost : 0;
+        if (exit != 0) {
+            iterations = std::min<i64>(iterations, exit - 1);
+        }
+        if constexpr (Policy::Interrupts) {
+            if (inputLog != nullptr && inputLog->Replaying()) {
+                uint64_t now = Now(cycles);
+                uint64_t event = inputLog->NextEventTime();
+                iterations = std::min<i64>(iterations, event > now ? (i64)std::min<uint64_t>((event - now) / cost, INT64_MAX) : 0);
+            }
+            else if (pendingInterrupts.load(std::memory_order_relaxed) != 0 || (registers.interruptFlags & I_NM) ||
+                (registers.I && (registers.interruptFlags & ~I_NM) != 0)) {
+                return;
+            }
+        }
+        if (iterations <= 0) {
+            return;
+        }
+
+        if (target != jumpPC) {
+            Word& value = registers[counter];
+            value += (Word)(iterations * ((mem[target] & 0x7F) == OP_INC ? 1 : -1));
+        }
+        cycles -= iterations * cost;
+        retired += iterations * instructions;
+    }
+    //Without CycleExact the budget counts instructions (and interrupt entries) instead of cycles
+    void InstructionRetired(i64& cycles) {
+        retired++;
+        if constexpr (!Policy::CycleExact) {
+            cycles--;
+        }
     }
     void Execute(i64 cycles, Memory& mem) {
+        if constexpr (Policy::Debugging) {
+            if (debugger != nullptr && debugger->Armed()) {
+                Run<true>(cycles, mem);
+                return;
+            }
+        }
+        Run<false>(cycles, mem);
+    }
+    //Watching: data accesses test Memory::pageFlags. Testing a flag on every access slows memory heavy code down noticeably,
+    //so the loop is compiled twice and Execute picks the version once per call
+    template<bool Watching>
+    void Run(i64 cycles, Memory& mem) {
+        budget = cycles;
+        if constexpr (Policy::ReverseExecution) {
+            if (history != nullptr) {
+                history->BeginCall(mem, retired, cycles);
+            }
+        }
+
         while (cycles > 0 && !halted)
         {
-            //Is high priority interrupt flag set?
-            if (registers.interruptFlags & I_NM) {
-                ExecuteInterrupt(cycles, mem, I_NM);
-                continue;
+            if constexpr (Policy::ReverseExecution) {
+                if (history != nullptr && history->AtBoundary(*this, cycles)) {
+                    break;
+                }
             }
-            else if (registers.I && registers.interruptFlags > 0) {
-                int lowestSetBit = static_cast<int>(log2(registers.interruptFlags & -registers.interruptFlags) + 1); //This is cool
-                ExecuteInterrupt(cycles, mem, (Interrupt)lowestSetBit);
-                continue;
+            if constexpr (Policy::Interrupts) {
+                if (PollInterrupts<Watching>(cycles, mem)) {
+                    InstructionRetired(cycles);
+                    continue;
+                }
             }
 
+            Word startPC = registers.PC;
+            i64 startCycles = cycles;
+
             Byte instByte = NextByte(cycles, mem);
+        decode:
             Opcode instruction = (Opcode)(instByte & 0x7F);
             bool addressMode = (instByte >> 7) == 1; //0 -> constant address, 1 -> register address)
 
@@ -330,232 +974,579 @@ struct CPU {
             case OP_NOOP: break;
             case OP_RESET: {
                 Reset(mem);
-                std::cout << "INFO: RESET instruction executed\n";
+                TraceBlock(0, Memory::MEM_SIZE);
+                if constexpr (Policy::Logging) {
+                    std::cout << "INFO: RESET instruction executed\n";
+                }
             } break;
             case OP_HALT: {
                 halted = true;
-                std::cout << "INFO: HALT instruction executed\n";
+                if constexpr (Policy::Logging) {
+                    std::cout << "INFO: HALT instruction executed\n";
+                }
             } break;
             case OP_INC: {
                 Byte reg = NextByte(cycles, mem);
-                registers[reg]++;
+                Reg(reg)++;
             } break;
             case OP_DEC: {
                 Byte reg = NextByte(cycles, mem);
-                registers[reg]--;
+                Reg(reg)--;
             } break;
             case OP_ADD: {
                 Byte reg1 = NextByte(cycles, mem);
                 Byte reg2 = NextByte(cycles, mem);
 
-                i64 result = (i64)registers[reg1] + registers[reg2]; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
-
-                registers[reg1] = result;
+                Reg(reg1) = AddWithFlags(Reg(reg1), Reg(reg2));
             } break;
             case OP_ADDC: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                i64 result = (i64)registers[reg] + value; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
-
-                registers[reg] = result;
+                Reg(reg) = AddWithFlags(Reg(reg), value);
             } break;
             case OP_SUB: {
                 Byte reg1 = NextByte(cycles, mem);
                 Byte reg2 = NextByte(cycles, mem);
 
-                i64 result = (i64)registers[reg1] - registers[reg2]; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                Reg(reg1) = SubtractWithFlags(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_ADDCB: {
+                Byte reg = NextByte(cycles, mem);
+                Byte value = NextByte(cycles, mem);
 
-                registers[reg1] = result;
+                Reg(reg) = AddWithFlags(Reg(reg), value);
             } break;
             case OP_SUBC: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                i64 result = (i64)registers[reg] - value; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                Reg(reg) = SubtractWithFlags(Reg(reg), value);
+            } break;
+            case OP_SUBCB: {
+                Byte reg = NextByte(cycles, mem);
+                Byte value = NextByte(cycles, mem);
 
-                registers[reg] = result;
+                Reg(reg) = SubtractWithFlags(Reg(reg), value);
+            } break;
+            case OP_CMP: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+                UpdateCompareFlags(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_CMPC: {
+                Byte reg = NextByte(cycles, mem);
+                UpdateCompareFlags(Reg(reg), NextWord(cycles, mem));
+            } break;
+            case OP_CMPCB: {
+                Byte reg = NextByte(cycles, mem);
+                UpdateCompareFlags(Reg(reg), NextByte(cycles, mem));
+            } break;
+            case OP_CMPA: {
+                Byte reg = NextByte(cycles, mem);
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+                UpdateCompareFlags(Reg(reg), ReadWord<Watching>(cycles, mem, address));
             } break;
             case OP_MUL: {
                 Byte reg1 = NextByte(cycles, mem);
                 Byte reg2 = NextByte(cycles, mem);
 
-                i64 result = (i64)registers[reg1] * registers[reg2]; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                i64 result = (i64)Reg(reg1) * Reg(reg2); //Cheating by casting to a larger type ;)
+                UpdateStatusFlags(result, result > UINT16_MAX); //Unsigned multiply, overflow and carry both mean the high word is lost
 
-                registers[reg1] = result;
+                Reg(reg1) = result;
             } break;
             case OP_MULC: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                i64 result = (i64)registers[reg] * value; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                i64 result = (i64)Reg(reg) * value; //Cheating by casting to a larger type ;)
+                UpdateStatusFlags(result, result > UINT16_MAX); //Unsigned multiply, overflow and carry both mean the high word is lost
 
-                registers[reg] = result;
+                Reg(reg) = result;
             } break;
             case OP_DIV: {
                 Byte reg1 = NextByte(cycles, mem);
                 Byte reg2 = NextByte(cycles, mem);
 
-                i64 result = (i64)registers[reg1] / registers[reg2]; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                i64 result = (i64)Reg(reg1) / Reg(reg2); //Cheating by casting to a larger type ;)
+                UpdateStatusFlags(result, false); //An unsigned quotient always fits
 
-                registers[reg1] = result;
+                Reg(reg1) = result;
             } break;
             case OP_DIVC: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                i64 result = (i64)registers[reg] / value; //Cheating by casting to a larger type ;)
-                UpdateStatusFlags(result);
+                i64 result = (i64)Reg(reg) / value; //Cheating by casting to a larger type ;)
+                UpdateStatusFlags(result, false); //An unsigned quotient always fits
 
-                registers[reg] = result;
+                Reg(reg) = result;
             } break;
             case OP_LSL: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                registers[reg] = registers[reg] << value;
+                Reg(reg) = ShiftLeft(Reg(reg), value);
             } break;
             case OP_LSR: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
 
-                registers[reg] = registers[reg] >> value;
+                Reg(reg) = ShiftRight(Reg(reg), value);
+            } break;
+            case OP_LSLR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) = ShiftLeft(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_LSRR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) = ShiftRight(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_ROL: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+
+                Reg(reg) = RotateLeft(Reg(reg), value);
+            } break;
+            case OP_ROLR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) = RotateLeft(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_ROR: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+
+                Reg(reg) = RotateRight(Reg(reg), value);
+            } break;
+            case OP_RORR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) = RotateRight(Reg(reg1), Reg(reg2));
+            } break;
+            case OP_AND: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) &= Reg(reg2);
+                UpdateLogicFlags(Reg(reg1));
+            } break;
+            case OP_ANDC: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+
+                Reg(reg) &= value;
+                UpdateLogicFlags(Reg(reg));
+            } break;
+            case OP_OR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) |= Reg(reg2);
+                UpdateLogicFlags(Reg(reg1));
+            } break;
+            case OP_ORC: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+
+                Reg(reg) |= value;
+                UpdateLogicFlags(Reg(reg));
+            } break;
+            case OP_XOR: {
+                Byte reg1 = NextByte(cycles, mem);
+                Byte reg2 = NextByte(cycles, mem);
+
+                Reg(reg1) ^= Reg(reg2);
+                UpdateLogicFlags(Reg(reg1));
+            } break;
+            case OP_XORC: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+
+                Reg(reg) ^= value;
+                UpdateLogicFlags(Reg(reg));
+            } break;
+            case OP_NOT: {
+                Byte reg = NextByte(cycles, mem);
+
+                Reg(reg) = ~Reg(reg);
+                UpdateLogicFlags(Reg(reg));
             } break;
             case OP_UXT: {
                 Byte reg = NextByte(cycles, mem);
-                registers[reg] &= 0xFF;
+                Reg(reg) &= 0xFF;
             } break;
             case OP_LDR: {
                 Byte reg1 = NextByte(cycles, mem);
                 Byte reg2 = NextByte(cycles, mem);
-                registers[reg1] = registers[reg2];
+                Reg(reg1) = Reg(reg2);
             } break;
             case OP_LDC: {
                 Byte reg = NextByte(cycles, mem);
-                registers[reg] = NextWord(cycles, mem);
+                Reg(reg) = NextWord(cycles, mem);
+            } break;
+            case OP_LDCB: {
+                Byte reg = NextByte(cycles, mem);
+                Reg(reg) = NextByte(cycles, mem);
             } break;
             case OP_LDM: {
                 Byte reg = NextByte(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
-                registers[reg] = ReadWord(cycles, mem, address);
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+                Reg(reg) = ReadWord<Watching>(cycles, mem, address);
             } break;
             case OP_STRM: {
                 Byte reg = NextByte(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                WriteWord(cycles, mem, address, registers[reg]);
+                WriteWord<Watching>(cycles, mem, address, Reg(reg));
             } break;
             case OP_STCM: {
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                WriteWord(cycles, mem, address, value);
+                WriteWord<Watching>(cycles, mem, address, value);
+            } break;
+            case OP_BMOV: {
+                Byte dst = NextByte(cycles, mem);
+                Byte src = NextByte(cycles, mem);
+                Byte length = NextByte(cycles, mem);
+                if (!BlockMove<Watching>(cycles, mem, dst, src, length)) {
+                    registers.PC -= BLOCK_INSTRUCTION_SIZE; //Resume the block on the next fetch
+                }
+            } break;
+            case OP_BSET: {
+                Byte dst = NextByte(cycles, mem);
+                Byte value = NextByte(cycles, mem);
+                Byte length = NextByte(cycles, mem);
+                if (!BlockFill<Watching>(cycles, mem, dst, value, length)) {
+                    registers.PC -= BLOCK_INSTRUCTION_SIZE;
+                }
+            } break;
+            case OP_BCMP: {
+                Byte a = NextByte(cycles, mem);
+                Byte b = NextByte(cycles, mem);
+                Byte length = NextByte(cycles, mem);
+                if (!BlockCompare<Watching>(cycles, mem, a, b, length)) {
+                    registers.PC -= BLOCK_INSTRUCTION_SIZE;
+                }
             } break;
             case OP_JMP: {
-                registers.PC = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                registers.PC = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
             } break;
             case OP_JRZ: {
-                if (registers[NextByte(cycles, mem)] == 0) {
-                    registers.PC = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                if (Reg(NextByte(cycles, mem)) == 0) {
+                    registers.PC = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
                 }
                 else {
-                    registers.PC += 2; //Avoid wasting 2 cycles with NextWord()
+                    registers.PC += addressMode ? 1 : 2; //Avoid wasting cycles reading the unused address
                 }
             } break;
             case OP_JRE: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                if (registers[reg] == value) {
+                if (Reg(reg) == value) {
                     registers.PC = address;
                 }
             } break;
             case OP_JRN: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                if (registers[reg] != value) {
+                if (Reg(reg) != value) {
                     registers.PC = address;
                 }
             } break;
             case OP_JRG: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                if (registers[reg] > value) {
+                if (Reg(reg) > value) {
                     registers.PC = address;
                 }
             } break;
             case OP_JRGE: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                if (registers[reg] >= value) {
+                if (Reg(reg) >= value) {
                     registers.PC = address;
                 }
             } break;
             case OP_JRL: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
 
-                if (registers[reg] < value) {
+                if (Reg(reg) < value) {
                     registers.PC = address;
                 }
             } break;
             case OP_JRLE: {
                 Byte reg = NextByte(cycles, mem);
                 Word value = NextWord(cycles, mem);
-                Word address = addressMode ? NextWord(cycles, mem) : registers[NextByte(cycles, mem)];
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+
+                if (Reg(reg) <= value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JMPS: {
+                registers.PC = NextRelative(cycles, mem);
+            } break;
+            case OP_JRZS: {
+                Byte reg = NextByte(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) == 0) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRES: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
 
-                if (registers[reg] <= value) {
+                if (Reg(reg) == value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRNS: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) != value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRGS: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) > value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRGES: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) >= value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRLS: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) < value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_JRLES: {
+                Byte reg = NextByte(cycles, mem);
+                Word value = NextWord(cycles, mem);
+                Word address = NextRelative(cycles, mem);
+
+                if (Reg(reg) <= value) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BEQ: {
+                Word address = NextRelative(cycles, mem);
+                if (registers.Z) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BNE: {
+                Word address = NextRelative(cycles, mem);
+                if (!registers.Z) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BLT: {
+                Word address = NextRelative(cycles, mem);
+                if (registers.N != registers.O) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BGE: {
+                Word address = NextRelative(cycles, mem);
+                if (registers.N == registers.O) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BCS: {
+                Word address = NextRelative(cycles, mem);
+                if (registers.C) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BCC: {
+                Word address = NextRelative(cycles, mem);
+                if (!registers.C) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BVS: {
+                Word address = NextRelative(cycles, mem);
+                if (registers.O) {
+                    registers.PC = address;
+                }
+            } break;
+            case OP_BVC: {
+                Word address = NextRelative(cycles, mem);
+                if (!registers.O) {
                     registers.PC = address;
                 }
             } break;
             case OP_JSR: {
-                Word newPC = NextWord(cycles, mem);
-                StackPush(cycles, mem, registers.PC); //Push program counter to stack
+                Word newPC = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+                StackPush<Watching>(cycles, mem, registers.PC); //Push program counter to stack
                 registers.PC = newPC; //Jump to start of subroutine
             } break;
+            case OP_JMPI: {
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+                registers.PC = ReadWord<Watching>(cycles, mem, address);
+            } break;
+            case OP_JSRI: {
+                Word address = addressMode ? Reg(NextByte(cycles, mem)) : NextWord(cycles, mem);
+                Word newPC = ReadWord<Watching>(cycles, mem, address);
+                StackPush<Watching>(cycles, mem, registers.PC);
+                registers.PC = newPC;
+            } break;
             case OP_RTN: {
-                registers.PC = StackPop(cycles, mem);
+                registers.PC = StackPop<Watching>(cycles, mem);
             } break;
             case OP_PUSH: {
                 Byte reg = NextByte(cycles, mem);
-                StackPush(cycles, mem, registers[reg]);
+                StackPush<Watching>(cycles, mem, Reg(reg));
             } break;
             case OP_PUSHC: {
                 Word value = NextWord(cycles, mem);
-                StackPush(cycles, mem, value);
+                StackPush<Watching>(cycles, mem, value);
+            } break;
+            case OP_PUSHCB: {
+                Word value = NextByte(cycles, mem);
+                StackPush<Watching>(cycles, mem, value);
             } break;
             case OP_PUSHS: {
-                StackPush(cycles, mem, registers.status);
+                StackPush<Watching>(cycles, mem, registers.status);
             } break;
             case OP_POP: {
                 Byte reg = NextByte(cycles, mem);
-                registers[reg] = StackPop(cycles, mem);
+                Reg(reg) = StackPop<Watching>(cycles, mem);
             } break;
             case OP_POPS: {
-                registers.status = (Byte)StackPop(cycles, mem);
+                registers.status = (Byte)StackPop<Watching>(cycles, mem);
             } break;
+            case OP_RTI: {
+                registers.PC = StackPop<Watching>(cycles, mem);
+                registers.status = (Byte)StackPop<Watching>(cycles, mem);
+            } break;
+            case OP_SEI: {
+                registers.I = 1;
+            } break;
+            case OP_CLI: {
+                registers.I = 0;
+            } break;
+            case OP_WAIT: {
+                //Falls through when an interrupt is raised, even a masked one. Otherwise it runs again at the next boundary,
+                //where an interrupt entry returns past it
+                if constexpr (Policy::Interrupts) {
+                    waiting = pendingInterrupts.load(std::memory_order_relaxed) == 0 && registers.interruptFlags == 0;
+                    if (waiting) {
+                        registers.PC = startPC;
+                        cycles = std::min<i64>(cycles, Policy::CycleExact ? 0 : 1); //Idle until the end of the budget
+                    }
+                }
+                else {
+                    halted = true; //Nothing can wake it
+                }
+            } break;
+            case OP_RDCYC:
+            case OP_RDCYCH:
+            case OP_RDINST:
+            case OP_RDINSTH: {
+                uint64_t counter = instruction == OP_RDCYC || instruction == OP_RDCYCH ? Now(startCycles) : retired;
+                if (instruction == OP_RDCYCH || instruction == OP_RDINSTH) {
+                    counter >>= 32;
+                }
+                Byte high = NextByte(cycles, mem);
+                Byte low = NextByte(cycles, mem);
+                Reg(high) = (Word)(counter >> 16);
+                Reg(low) = (Word)counter;
+            } break;
+            case OP_BRK: //Only checked when an OP_BRK is executed, so breakpoints cost nothing elsewhere
+                if constexpr (Policy::Debugging) {
+                    if (debugger != nullptr && debugger->IsBreakpoint(startPC)) {
+                        if (debugger->StopAtBreakpoint(retired)) {
+                            registers.PC = startPC; //Stopped before the instruction, it runs when execution continues
+                            cycles = startCycles;
+                            Trap(cycles);
+                            continue;
+                        }
+                        instByte = debugger->OriginalByte(startPC);
+                        goto decode;
+                    }
+                }
+                [[fallthrough]];
             default:
-                throw std::exception("ERROR: Illegal instruction\n");
+                if constexpr (Policy::StrictChecks) {
+                    throw std::runtime_error("ERROR: Illegal instruction\n");
+                }
+                else {
+                    halted = true;
+                }
+            }
+
+            if constexpr (Policy::Profiling) {
+                if (profiler != nullptr) {
+                    profiler->Record(startPC, instByte, startCycles - cycles, registers.PC);
+                }
+            }
+            if constexpr (Policy::Tracing) {
+                if (tracer != nullptr) {
+                    tracer->Retire(TraceRecord::INSTRUCTION, startPC, instByte, startCycles - cycles, registers);
+                }
+            }
+            InstructionRetired(cycles);
+            if constexpr (Policy::FastForward) {
+                if (registers.PC == startPC || registers.PC == (Word)(startPC - 2)) { //Back to itself or to a 2 byte instruction before it
+                    FastForward(cycles, mem, startPC, startCycles);
+                }
+            }
+        }
+        cycles += trapped;
+        trapped = 0;
+        elapsed += budget - cycles;
+        if constexpr (Policy::ReverseExecution) {
+            if (history != nullptr) {
+                history->EndCall(retired);
             }
         }
 
-        if (cycles < 0) {
-            std::cout << "WARNING: CPU used additional cycles. This is unintended behaviour\n";
+        if constexpr (Policy::Logging) {
+            if (cycles < 0 && (debugger == nullptr || !debugger->Stepping())) {
+                std::cout << "WARNING: CPU used additional cycles. This is unintended behaviour\n";
+            }
         }
     }
-};
\ No newline at end of file
+};
+
+using CPU = BasicCPU<CPUPolicy>;
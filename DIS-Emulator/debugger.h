@@ -0,0 +1,180 @@
+#pragma once
+#include <map>
+#include <vector>
+
+/// <summary>
+/// Breakpoints and watchpoints for CPU::Execute. Include cpu.h rather than this file.
+///  - Nothing is checked per instruction. A breakpoint replaces the first byte of its instruction with OP_BRK, which only
+///    asks the Debugger when it is executed, and the saved byte is decoded instead when execution continues past it
+///  - Watchpoints flag their pages in Memory::pageFlags. While anything is armed Execute runs a version of its loop whose data
+///    accesses test the flags of the pages they touch, and only accesses to flagged pages reach the Debugger, which compares
+///    them with the exact ranges. With nothing armed the loop has no tests at all
+///  - A hit ends Execute: before the instruction for a breakpoint, after the accessing instruction for a watchpoint
+///  - Guest writes over a breakpoint and RESET keep it armed, the written byte becomes the saved one. Guest reads of a
+///    patched byte see OP_BRK, and bytes the host writes into memory are not noticed, so set breakpoints after loading
+/// </summary>
+struct Debugger
+{
+    enum StopReason : Byte {
+        STOP_NONE,          //The budget was used up or the CPU halted
+        STOP_BREAKPOINT,
+        STOP_READ_WATCH,
+        STOP_WRITE_WATCH,
+        STOP_STEP,
+    };
+    struct Watchpoint {
+        Word address;
+        DWord length;
+        Byte kinds;         //Memory::PAGE_WATCH_READ and/or Memory::PAGE_WATCH_WRITE
+    };
+
+    std::map<Word, Byte> breakpoints; //Address -> the byte OP_BRK replaced
+    std::vector<Watchpoint> watchpoints;
+
+    StopReason reason = STOP_NONE;
+    Word dataAddress = 0; //Access that hit the watchpoint
+
+    bool AddBreakpoint(Memory& mem, Word address) {
+        if (IsBreakpoint(address)) {
+            return false;
+        }
+        breakpoints[address] = mem[address];
+        mem[address] = OP_BRK;
+        UpdatePageFlags(mem);
+        return true;
+    }
+    bool RemoveBreakpoint(Memory& mem, Word address) {
+        auto breakpoint = breakpoints.find(address);
+        if (breakpoint == breakpoints.end()) {
+            return false;
+        }
+        mem[address] = breakpoint->second;
+        breakpoints.erase(breakpoint);
+        UpdatePageFlags(mem);
+        return true;
+    }
+    void AddWatchpoint(Memory& mem, Word address, DWord length, Byte kinds) {
+        watchpoints.push_back(Watchpoint{ address, std::min<DWord>(std::max<DWord>(length, 1), Memory::MEM_SIZE), kinds });
+        UpdatePageFlags(mem);
+    }
+    bool RemoveWatchpoint(Memory& mem, Word address, DWord length, Byte kinds) {
+        auto watchpoint = std::find_if(watchpoints.begin(), watchpoints.end(), [&](const Watchpoint& w) {
+            return w.address == address && w.length == std::max<DWord>(length, 1) && w.kinds == kinds;
+        });
+        if (watchpoint == watchpoints.end()) {
+            return false;
+        }
+        watchpoints.erase(watchpoint);
+        UpdatePageFlags(mem);
+        return true;
+    }
+    //Removes everything and puts the patched bytes back
+    void Detach(Memory& mem) {
+        for (auto& [address, original] : breakpoints) {
+            mem[address] = original;
+        }
+        breakpoints.clear();
+        watchpoints.clear();
+        UpdatePageFlags(mem);
+    }
+    //Memory as the guest program wrote it, without the patched breakpoints
+    Byte Peek(const Memory& mem, Word address) const {
+        auto breakpoint = breakpoints.find(address);
+        return breakpoint != breakpoints.end() ? breakpoint->second : mem[address];
+    }
+    void Poke(Memory& mem, Word address, Byte value) {
+        auto breakpoint = breakpoints.find(address);
+        if (breakpoint != breakpoints.end()) {
+            breakpoint->second = value;
+        }
+        else {
+            mem[address] = value;
+        }
+    }
+
+    //Runs until a breakpoint or watchpoint is hit, the CPU halts or the budget is used up. A breakpoint at the current PC
+    //is stepped over so execution can continue after stopping at it
+    template<typename CPU>
+    StopReason Continue(CPU& cpu, Memory& mem, i64 cycles) {
+        reason = STOP_NONE;
+        skipRetired = cpu.retired;
+        cpu.Execute(cycles, mem);
+        return reason;
+    }
+    //Executes one instruction, interrupt entry or chunk of a block instruction
+    template<typename CPU>
+    StopReason Step(CPU& cpu, Memory& mem) {
+        reason = STOP_NONE;
+        skipRetired = cpu.retired;
+        stepping = true;
+        cpu.Execute(1, mem);
+        stepping = false;
+        if (reason == STOP_NONE && !cpu.halted) {
+            reason = STOP_STEP;
+        }
+        return reason;
+    }
+
+    //Called by the CPU when it executes OP_BRK
+    bool IsBreakpoint(Word address) const {
+        return breakpoints.count(address) != 0;
+    }
+    bool StopAtBreakpoint(uint64_t retired) {
+        if (retired == skipRetired) {
+            return false; //First instruction after Continue or Step
+        }
+        reason = STOP_BREAKPOINT;
+        return true;
+    }
+    Byte OriginalByte(Word address) const {
+        return breakpoints.at(address);
+    }
+    //Execute only tests the page flags while this is true
+    bool Armed() const {
+        return !breakpoints.empty() || !watchpoints.empty();
+    }
+    bool Stepping() const {
+        return stepping;
+    }
+
+    //Called by the CPU for data accesses to flagged pages. Returns true if a watchpoint was hit
+    bool MemoryAccess(Memory& mem, Word address, DWord bytes, Byte flags) {
+        if (flags & Memory::PAGE_BREAKPOINT) {
+            for (auto& [breakpoint, original] : breakpoints) {
+                if (Overlaps(breakpoint, 1, address, bytes) && mem[breakpoint] != OP_BRK) {
+                    original = mem[breakpoint];
+                    mem[breakpoint] = OP_BRK;
+                }
+            }
+        }
+        for (const Watchpoint& watchpoint : watchpoints) {
+            if ((watchpoint.kinds & flags) != 0 && Overlaps(watchpoint.address, watchpoint.length, address, bytes)) {
+                reason = (flags & Memory::PAGE_WATCH_WRITE) ? STOP_WRITE_WATCH : STOP_READ_WATCH;
+                dataAddress = Overlaps(watchpoint.address, watchpoint.length, address, 1) ? address : watchpoint.address;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    uint64_t skipRetired = UINT64_MAX;
+    bool stepping = false;
+
+    //Ranges wrap past the end of memory like CPU accesses
+    static bool Overlaps(Word a, DWord aLength, Word b, DWord bLength) {
+        return (Word)(b - a) < aLength || (Word)(a - b) < bLength;
+    }
+    void UpdatePageFlags(Memory& mem) const {
+        memset(mem.pageFlags, 0, sizeof(mem.pageFlags));
+        for (auto& [address, original] : breakpoints) {
+            mem.pageFlags[address / Memory::PAGE_SIZE] |= Memory::PAGE_BREAKPOINT;
+        }
+        for (const Watchpoint& watchpoint : watchpoints) {
+            DWord pages = ((watchpoint.address % Memory::PAGE_SIZE) + watchpoint.length - 1) / Memory::PAGE_SIZE + 1;
+            for (DWord i = 0; i < std::min(pages, Memory::PAGE_COUNT); i++) {
+                mem.pageFlags[(Byte)(watchpoint.address / Memory::PAGE_SIZE + i)] |= watchpoint.kinds;
+            }
+        }
+    }
+};
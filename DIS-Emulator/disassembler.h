@@ -0,0 +1,301 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "cpu.h"
+#include "symbols.h"
+
+struct DecodedInstruction
+{
+    Word address = 0;
+    Byte instByte = 0;
+    bool valid = false;                     //Unassigned instruction byte, or the image ends inside the instruction
+    const OpcodeInfo* info = &OPCODES[0];
+    Word operands[3] = {};                  //In encoding order. Relative displacements are already the absolute target
+
+    //Bytes to skip, an invalid instruction is one byte of data
+    Byte Size() const {
+        return valid ? info->length : 1;
+    }
+    Word Next() const {
+        return address + Size();
+    }
+    //Target of a jump, branch or call that is known from the encoding alone
+    bool StaticTarget(Word& target) const {
+        if (!valid || info->operandCount == 0) {
+            return false;
+        }
+        OperandKind last = info->operands[info->operandCount - 1];
+        if (last == OPERAND_RELATIVE || (last == OPERAND_TARGET && !info->registerMode)) {
+            target = operands[info->operandCount - 1];
+            return true;
+        }
+        return false;
+    }
+};
+
+/// <summary>
+/// Table driven disassembler for program images, everything it knows about the encoding comes from OPCODES.
+///  - Decode and Format never allocate and Format only consults SymbolMap for code addresses, so trace and profile tools
+///    can disassemble every instruction they print on the fly
+///  - Output uses the assembler's syntax, code addresses are written as label or label+0xN
+///  - Sweep decodes linearly, invalid bytes come out as one byte of data. FollowFlow only marks instructions reachable from
+///    entry points through fall through, branches, calls, constant JMPI/JSRI pointers and constant stores into the
+///    interrupt table, so data between code is not decoded. Code only reached through computed addresses needs its own entry
+/// </summary>
+struct Disassembler
+{
+    static constexpr size_t MAX_TEXT = 96;  //Format buffer size
+    static constexpr size_t MAX_LABEL = 64; //Longer label names are cut short in operands
+
+    const Byte* image = nullptr;
+    size_t size = 0;
+    Word origin = 0;                        //Address of image[0]
+    const SymbolMap* symbols = nullptr;     //Optional
+
+    Disassembler() = default;
+    Disassembler(const Byte* image, size_t size, Word origin = 0, const SymbolMap* symbols = nullptr)
+        : image(image), size(std::min<size_t>(size, Memory::MEM_SIZE)), origin(origin), symbols(symbols) {
+    }
+
+    bool Contains(Word address, Byte bytes = 1) const {
+        return (size_t)(Word)(address - origin) + bytes <= size;
+    }
+
+    bool Decode(Word address, DecodedInstruction& inst) const {
+        if (!Contains(address)) {
+            inst = DecodedInstruction{ address };
+            return false;
+        }
+        size_t offset = (Word)(address - origin);
+        return Decode(image + offset, size - offset, address, inst);
+    }
+    //Decodes from raw bytes, available must be at least 1
+    static bool Decode(const Byte* bytes, size_t available, Word address, DecodedInstruction& inst) {
+        const OpcodeInfo& info = OPCODES[bytes[0]];
+        inst.address = address;
+        inst.instByte = bytes[0];
+        inst.info = &info;
+        inst.valid = info.Valid() && info.length <= available;
+        if (!inst.valid) {
+            return false;
+        }
+        for (Byte i = 0; i < info.operandCount; i++) {
+            const Byte* operand = bytes + info.offsets[i];
+            Word value = info.sizes[i] == 2 ? (Word)(operand[0] | (operand[1] << 8)) : operand[0];
+            if (info.operands[i] == OPERAND_RELATIVE) {
+                value = (Word)(address + info.length + (int8_t)value);
+            }
+            inst.operands[i] = value;
+        }
+        return true;
+    }
+
+    //Writes the instruction text and a terminating 0 into a buffer of MAX_TEXT characters, returns the length
+    size_t Format(const DecodedInstruction& inst, char* buffer) const {
+        char* out = buffer;
+        if (!inst.valid) {
+            out = PutText(out, ".byte ", 6);
+            out = PutHex(out, inst.instByte, 2);
+        }
+        else {
+            const OpcodeInfo& info = *inst.info;
+            memcpy(out, info.mnemonic, sizeof(info.mnemonic));
+            out += info.mnemonicLength;
+            for (Byte i = 0; i < info.operandCount; i++) {
+                Byte index = info.storeOrder ? info.operandCount - 1 - i : i;
+                *out++ = ' ';
+                out = PutOperand(out, info, info.operands[index], inst.operands[index]);
+            }
+        }
+        *out = '\0';
+        return out - buffer;
+    }
+    std::string Format(const DecodedInstruction& inst) const {
+        char buffer[MAX_TEXT];
+        size_t length = Format(inst, buffer);
+        return std::string(buffer, length);
+    }
+
+    //Calls visit(const DecodedInstruction&) for everything from "from" up to "to" (exclusive) or the end of the image
+    template<typename Visit>
+    void Sweep(Word from, DWord to, Visit&& visit) const {
+        DecodedInstruction inst;
+        DWord address = from;
+        while (address < to && Contains((Word)address)) {
+            Decode((Word)address, inst);
+            visit(inst);
+            address += inst.Size();
+        }
+    }
+
+    //Marks the image offsets where a reachable instruction starts
+    std::vector<bool> FollowFlow(const std::vector<Word>& entries) const {
+        std::vector<bool> code(size);
+        std::vector<Word> pending(entries);
+        DecodedInstruction inst;
+        while (!pending.empty()) {
+            Word address = pending.back();
+            pending.pop_back();
+
+            //Runs down the fall through path, other successors are queued
+            while (Contains(address) && !code[(Word)(address - origin)] && Decode(address, inst)) {
+                code[(Word)(address - origin)] = true;
+                const OpcodeInfo& info = *inst.info;
+                Word target;
+                if (inst.StaticTarget(target)) {
+                    pending.push_back(target);
+                }
+                else if (info.mode == MODE_POINTER && !info.registerMode && Contains(inst.operands[0], 2)) {
+                    pending.push_back(ReadWord(inst.operands[0]));
+                }
+                else if (inst.instByte == OP_STCM && inst.operands[1] >= Memory::INTERRUPT_TABLE) {
+                    pending.push_back(inst.operands[0]); //Interrupt handler
+                }
+
+                if (info.flow == FLOW_JUMP || info.flow == FLOW_RETURN || info.flow == FLOW_STOP) {
+                    break;
+                }
+                address = inst.Next();
+            }
+        }
+        return code;
+    }
+
+    //Prints "address  bytes  text" lines with a line for every label. With code from FollowFlow, everything else is data.
+    //Without it the image is swept linearly, which restarts at labels an instruction decoded from data would run into
+    void Listing(FILE* file, const std::vector<bool>* code = nullptr) const {
+        char text[MAX_TEXT];
+        DecodedInstruction inst;
+        size_t offset = 0;
+        while (offset < size) {
+            Word address = (Word)(origin + offset);
+            PrintLabel(file, address);
+
+            bool decode = code == nullptr || (*code)[offset];
+            if (decode) {
+                Decode(address, inst);
+                if (code != nullptr || !CrossesLabel(inst)) {
+                    Format(inst, text);
+                    PrintLine(file, address, inst.Size(), text);
+                    offset += inst.Size();
+                    continue;
+                }
+            }
+
+            //Data up to the next instruction or label, 8 bytes per line
+            size_t end = offset + 1;
+            while (end < size && end - offset < 8 && !IsLabel((Word)(origin + end)) && (decode ? end < offset + inst.Size() : !(*code)[end])) {
+                end++;
+            }
+            char* out = PutText(text, ".byte", 5);
+            for (size_t i = offset; i < end; i++) {
+                *out++ = ' ';
+                out = PutHex(out, image[i], 2);
+            }
+            *out = '\0';
+            PrintLine(file, address, (Byte)(end - offset), text);
+            offset = end;
+        }
+    }
+
+private:
+    //Text is written without bounds checks, Format's longest output fits MAX_TEXT. The writers return the new end
+    static char* PutText(char* out, const char* text, size_t length) {
+        memcpy(out, text, length);
+        return out + length;
+    }
+    static char* PutHex(char* out, Word value, int digits) {
+        static const char hex[] = "0123456789ABCDEF";
+        out[0] = '0';
+        out[1] = 'x';
+        for (int i = digits + 1; i >= 2; i--) {
+            out[i] = hex[value & 15];
+            value >>= 4;
+        }
+        return out + digits + 2;
+    }
+    static char* PutRegister(char* out, Byte reg) {
+        if (reg == 6 || reg == 7) {
+            return PutText(out, reg == 6 ? "rpc" : "rsp", 3);
+        }
+        *out++ = 'r';
+        if (reg >= 100) {
+            *out++ = (char)('0' + reg / 100);
+        }
+        if (reg >= 10) {
+            *out++ = (char)('0' + reg / 10 % 10);
+        }
+        *out++ = (char)('0' + reg % 10);
+        return out;
+    }
+
+    Word ReadWord(Word address) const {
+        size_t offset = (Word)(address - origin);
+        return image[offset] | (image[offset + 1] << 8);
+    }
+    bool IsLabel(Word address) const {
+        return symbols != nullptr && symbols->labels.count(address) != 0;
+    }
+    bool CrossesLabel(const DecodedInstruction& inst) const {
+        if (symbols == nullptr || inst.Size() == 1) {
+            return false;
+        }
+        auto next = symbols->labels.upper_bound(inst.address);
+        return next != symbols->labels.end() && next->first < (DWord)inst.address + inst.Size();
+    }
+
+    char* PutCodeAddress(char* out, Word address) const {
+        auto label = symbols == nullptr ? nullptr : symbols->Find(address);
+        if (label == nullptr) {
+            return PutHex(out, address, 4);
+        }
+        out = PutText(out, label->second.data(), std::min(label->second.size(), MAX_LABEL));
+        if (label->first != address) {
+            Word delta = address - label->first;
+            *out++ = '+';
+            out = PutHex(out, delta, delta > 0xFFF ? 4 : delta > 0xFF ? 3 : delta > 0xF ? 2 : 1);
+        }
+        return out;
+    }
+    char* PutOperand(char* out, const OpcodeInfo& info, OperandKind kind, Word value) const {
+        switch (kind)
+        {
+        case OPERAND_REGISTER:
+            return PutRegister(out, (Byte)value);
+        case OPERAND_BYTE:
+            return PutHex(out, value, 2);
+        case OPERAND_WORD:
+            return PutHex(out, value, 4);
+        case OPERAND_MEMORY:
+        case OPERAND_POINTER:
+            *out++ = '[';
+            out = info.registerMode ? PutRegister(out, (Byte)value) : PutHex(out, value, 4);
+            *out++ = ']';
+            return out;
+        case OPERAND_TARGET:
+            return info.registerMode ? PutRegister(out, (Byte)value) : PutCodeAddress(out, value);
+        case OPERAND_RELATIVE:
+            return PutCodeAddress(out, value);
+        default:
+            return out;
+        }
+    }
+
+    void PrintLabel(FILE* file, Word address) const {
+        if (symbols == nullptr) {
+            return;
+        }
+        auto label = symbols->labels.find(address);
+        if (label != symbols->labels.end()) {
+            std::fprintf(file, "%s:\n", label->second.c_str());
+        }
+    }
+    void PrintLine(FILE* file, Word address, Byte length, const char* text) const {
+        char bytes[3 * 8 + 1] = {};
+        for (Byte i = 0; i < std::min<Byte>(length, 8); i++) {
+            std::snprintf(bytes + i * 3, 4, "%02X ", image[(Word)(address - origin) + i]);
+        }
+        std::fprintf(file, "    0x%04X  %-24s %s\n", address, bytes, text);
+    }
+};
@@ -0,0 +1,319 @@
+#pragma once
+#include <cstdlib>
+#include <string>
+#include "cpu.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+/// <summary>
+/// GDB remote serial protocol stub on top of Debugger, listening on the loopback interface only.
+///  - Registers (g/G/p/P) are R0-R5, PC, SP and a status register with the status flags in the low byte and the
+///    interrupt flags in the high byte, all 16 bit little endian
+///  - Supports m/M, c/s, Z0/Z1 breakpoints, Z2/Z3/Z4 watchpoints, ?, k and D. Ctrl-C stops a running continue
+///  - HandlePacket works without a connection so the stub can be driven by other transports
+/// </summary>
+template<typename CPU>
+struct GdbStub
+{
+    static constexpr i64 SLICE = 100000; //Cycles run between checks for Ctrl-C
+
+    CPU& cpu;
+    Memory& mem;
+    Debugger debugger;
+
+    GdbStub(CPU& cpu, Memory& mem) : cpu(cpu), mem(mem) {
+        cpu.debugger = &debugger;
+    }
+    ~GdbStub() {
+        debugger.Detach(mem);
+        cpu.debugger = nullptr;
+    }
+
+    //Waits for one connection on 127.0.0.1:port and serves it until the client kills or detaches
+    bool Serve(Word port) {
+#ifdef _WIN32
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+            return false;
+        }
+#endif
+        Socket server = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        if (server == INVALID || bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 1) != 0) {
+            Close(server);
+            return false;
+        }
+        printf("INFO: Waiting for GDB on 127.0.0.1:%d\n", port);
+        client = accept(server, nullptr, nullptr);
+        Close(server);
+        if (client == INVALID) {
+            return false;
+        }
+
+        std::string packet;
+        while (ReceivePacket(packet)) {
+            if (packet == "k") {
+                break;
+            }
+            SendPacket(HandlePacket(packet));
+            if (packet[0] == 'D') {
+                break;
+            }
+        }
+        Close(client);
+        client = INVALID;
+        debugger.Detach(mem);
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return true;
+    }
+
+    //Returns the reply to one packet (without the framing)
+    std::string HandlePacket(const std::string& packet) {
+        const char* args = packet.c_str() + 1;
+        switch (packet.empty() ? 0 : packet[0])
+        {
+        case '?':
+            return StopReply();
+        case 'g': {
+            std::string reply;
+            for (Byte i = 0; i < REGISTER_COUNT; i++) {
+                reply += HexWord(ReadRegister(i));
+            }
+            return reply;
+        }
+        case 'G': {
+            for (Byte i = 0; i < REGISTER_COUNT && strlen(args) >= (i + 1) * 4u; i++) {
+                WriteRegister(i, ParseHexWord(args + i * 4));
+            }
+            return "OK";
+        }
+        case 'p': {
+            DWord index = (DWord)strtoul(args, nullptr, 16);
+            return index < REGISTER_COUNT ? HexWord(ReadRegister((Byte)index)) : "E01";
+        }
+        case 'P': {
+            char* value;
+            DWord index = (DWord)strtoul(args, &value, 16);
+            if (index >= REGISTER_COUNT || *value != '=') {
+                return "E01";
+            }
+            WriteRegister((Byte)index, ParseHexWord(value + 1));
+            return "OK";
+        }
+        case 'm': {
+            char* end;
+            Word address = (Word)strtoul(args, &end, 16);
+            DWord length = *end == ',' ? (DWord)strtoul(end + 1, nullptr, 16) : 0;
+            std::string reply;
+            for (DWord i = 0; i < std::min<DWord>(length, 0x800); i++) {
+                reply += HexByte(debugger.Peek(mem, (Word)(address + i)));
+            }
+            return reply;
+        }
+        case 'M': {
+            char* end;
+            Word address = (Word)strtoul(args, &end, 16);
+            DWord length = *end == ',' ? (DWord)strtoul(end + 1, &end, 16) : 0;
+            if (*end != ':' || strlen(end + 1) / 2 < length) { //length * 2 would wrap for huge lengths
+                return "E01";
+            }
+            for (DWord i = 0; i < length; i++) {
+                debugger.Poke(mem, (Word)(address + i), (Byte)strtoul(std::string(end + 1 + i * 2, 2).c_str(), nullptr, 16));
+            }
+            return "OK";
+        }
+        case 'c':
+        case 's': {
+            if (*args != 0) {
+                cpu.registers.PC = (Word)strtoul(args, nullptr, 16);
+            }
+            return Resume(packet[0] == 's');
+        }
+        case 'Z':
+        case 'z': {
+            char* end;
+            int type = (int)strtol(args, &end, 16);
+            Word address = *end == ',' ? (Word)strtoul(end + 1, &end, 16) : 0;
+            DWord length = *end == ',' ? (DWord)strtoul(end + 1, nullptr, 16) : 1;
+            bool add = packet[0] == 'Z';
+            if (type == 0 || type == 1) { //Software and hardware breakpoints are the same thing here
+                if (add) {
+                    debugger.AddBreakpoint(mem, address);
+                }
+                else {
+                    debugger.RemoveBreakpoint(mem, address);
+                }
+                return "OK";
+            }
+            if (type >= 2 && type <= 4) {
+                Byte kinds = type == 2 ? Memory::PAGE_WATCH_WRITE : type == 3 ? Memory::PAGE_WATCH_READ : Memory::PAGE_WATCH_READ | Memory::PAGE_WATCH_WRITE;
+                if (add) {
+                    debugger.AddWatchpoint(mem, address, length, kinds);
+                }
+                else {
+                    debugger.RemoveWatchpoint(mem, address, length, kinds);
+                }
+                return "OK";
+            }
+            return "";
+        }
+        case 'D':
+            debugger.Detach(mem);
+            return "OK";
+        case 'q':
+            if (packet.rfind("qSupported", 0) == 0) {
+                return "PacketSize=1000";
+            }
+            if (packet == "qAttached") {
+                return "1";
+            }
+            return "";
+        default:
+            return ""; //Unsupported
+        }
+    }
+
+private:
+#ifdef _WIN32
+    typedef SOCKET Socket;
+    static constexpr Socket INVALID = INVALID_SOCKET;
+    static void Close(Socket s) {
+        if (s != INVALID) {
+            closesocket(s);
+        }
+    }
+#else
+    typedef int Socket;
+    static constexpr Socket INVALID = -1;
+    static void Close(Socket s) {
+        if (s != INVALID) {
+            close(s);
+        }
+    }
+#endif
+    static constexpr Byte REGISTER_COUNT = 9;
+
+    Socket client = INVALID;
+    bool interrupted = false;
+
+    Word ReadRegister(Byte index) const {
+        return index < 8 ? cpu.registers.aligned[index] : (Word)(cpu.registers.status | (cpu.registers.interruptFlags << 8));
+    }
+    void WriteRegister(Byte index, Word value) {
+        if (index < 8) {
+            cpu.registers.aligned[index] = value;
+        }
+        else {
+            cpu.registers.status = value & 0xFF;
+            cpu.registers.interruptFlags = value >> 8;
+        }
+    }
+
+    std::string Resume(bool step) {
+        interrupted = false;
+        if (step) {
+            debugger.Step(cpu, mem);
+        }
+        else {
+            while (debugger.Continue(cpu, mem, SLICE) == Debugger::STOP_NONE && !cpu.halted && !Interrupted()) {}
+        }
+        return StopReply();
+    }
+    std::string StopReply() const {
+        if (cpu.halted) {
+            return "W00";
+        }
+        switch (debugger.reason)
+        {
+        case Debugger::STOP_READ_WATCH:
+            return "T05rwatch:" + HexAddress(debugger.dataAddress) + ";";
+        case Debugger::STOP_WRITE_WATCH:
+            return "T05watch:" + HexAddress(debugger.dataAddress) + ";";
+        case Debugger::STOP_NONE:
+            return interrupted ? "S02" : "S05";
+        default:
+            return "S05";
+        }
+    }
+
+    //Polls for the Ctrl-C byte GDB sends while the target runs
+    bool Interrupted() {
+        if (client == INVALID) {
+            return false;
+        }
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(client, &set);
+        timeval timeout{};
+        char byte;
+        if (select((int)client + 1, &set, nullptr, nullptr, &timeout) > 0 && recv(client, &byte, 1, 0) == 1 && byte == 0x03) {
+            interrupted = true;
+        }
+        return interrupted;
+    }
+
+    bool ReceivePacket(std::string& packet) {
+        char byte;
+        while (recv(client, &byte, 1, 0) == 1) {
+            if (byte != '$') {
+                continue; //Acks and stray Ctrl-C
+            }
+            packet.clear();
+            while (recv(client, &byte, 1, 0) == 1 && byte != '#') {
+                packet += byte;
+            }
+            char checksum[2];
+            if (recv(client, checksum, 2, MSG_WAITALL) != 2) {
+                return false;
+            }
+            bool valid = (Byte)strtoul(std::string(checksum, 2).c_str(), nullptr, 16) == Checksum(packet);
+            send(client, valid ? "+" : "-", 1, 0);
+            if (valid && !packet.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+    void SendPacket(const std::string& reply) {
+        std::string framed = "$" + reply + "#" + HexByte(Checksum(reply));
+        send(client, framed.c_str(), (int)framed.size(), 0);
+    }
+
+    static Byte Checksum(const std::string& data) {
+        Byte sum = 0;
+        for (char c : data) {
+            sum += (Byte)c;
+        }
+        return sum;
+    }
+    static std::string HexByte(Byte value) {
+        static const char digits[] = "0123456789abcdef";
+        return { digits[value >> 4], digits[value & 15] };
+    }
+    //Register values are sent in target (little endian) byte order
+    static std::string HexWord(Word value) {
+        return HexByte(value & 0xFF) + HexByte(value >> 8);
+    }
+    static Word ParseHexWord(const char* text) {
+        Byte low = (Byte)strtoul(std::string(text, 2).c_str(), nullptr, 16);
+        Byte high = (Byte)strtoul(std::string(text + 2, 2).c_str(), nullptr, 16);
+        return low | (high << 8);
+    }
+    static std::string HexAddress(Word value) {
+        return HexByte(value >> 8) + HexByte(value & 0xFF);
+    }
+};
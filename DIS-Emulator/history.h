@@ -0,0 +1,291 @@
+#pragma once
+#include <deque>
+#include <vector>
+
+/// <summary>
+/// Checkpoint history for reverse execution. Include cpu.h rather than this file.
+///  - Every interval cycles the CPU saves its Registers. The first write to a memory page after a checkpoint saves the page
+///    as it was at that checkpoint, so going back is undoing the saved pages from the newest checkpoint down
+///  - Execute calls are logged so re-execution from a checkpoint uses the same budgets and block instructions split identically
+///  - Host writes between Execute calls that go through CPU::BeforeWrite (BlockDevice transfers and registers) are logged with
+///    the next call and re-applied before it. The host's own state, e.g. a device's transfers in flight, is not rewound
+///  - The oldest checkpoints are dropped to stay inside memoryBudget, which limits how far back the history reaches
+///  - Positions are CPU::retired counts: going back to n leaves the CPU just before its nth instruction (or interrupt entry)
+///  - Re-execution does not see live interrupts, replay them from an InputLog to step back over interrupt driven code
+/// </summary>
+struct ExecutionHistory
+{
+    static constexpr DWord PAGE_SIZE = 256;
+    static constexpr DWord PAGE_COUNT = Memory::MEM_SIZE / PAGE_SIZE;
+
+    struct Page {
+        Byte index;
+        Byte data[PAGE_SIZE];
+    };
+    struct Checkpoint {
+        uint64_t retired;
+        uint64_t time;      //CPU::Now()
+        Registers registers;
+        bool halted;
+        bool waiting;
+        uint64_t call;      //Execute call that was running
+        i64 remaining;      //Budget it had left
+        std::vector<Page> pages; //Pages as they were at this checkpoint, for the pages written before the next one
+    };
+    struct HostWrite {
+        Word address;
+        std::vector<Byte> data;
+    };
+    struct Call {
+        i64 budget;
+        uint64_t endRetired;
+        std::vector<HostWrite> hostWrites; //Made before the call, memory wraps past 0xFFFF
+    };
+
+    i64 interval = 10000;               //Cycles (instructions without CycleExact) between checkpoints
+    size_t memoryBudget = 16 << 20;     //Bytes of checkpoints, saved pages and host writes
+
+    std::deque<Checkpoint> checkpoints;
+    size_t bytesUsed = 0;
+
+    //Called by the CPU before every instruction. Returns true to stop Execute at a position
+    template<typename CPU>
+    bool AtBoundary(CPU& cpu, i64 cycles) {
+        if (cpu.retired >= stopAt) {
+            stopped = true;
+            stoppedRemaining = cycles;
+            return true;
+        }
+        if (cpu.Now(cycles) >= nextCheckpoint) {
+            TakeCheckpoint(cpu, cycles);
+        }
+        return false;
+    }
+    //Called by the CPU before it writes memory
+    void BeforeWrite(const Memory& mem, Word address, DWord bytes, uint64_t retired) {
+        if (watching && (Word)(watchAddress - address) < bytes) {
+            lastWatchedWrite = retired;
+            watchHit = true;
+        }
+        if (!inCall && !replaying) {
+            hostRanges.emplace_back(address, std::min<DWord>(bytes, Memory::MEM_SIZE)); //Copied once the next call starts
+        }
+        if (checkpoints.empty()) {
+            return;
+        }
+        DWord first = address / PAGE_SIZE;
+        DWord count = bytes >= Memory::MEM_SIZE ? PAGE_COUNT : ((address + bytes - 1) / PAGE_SIZE) - first + 1;
+        for (DWord i = 0; i < count; i++) {
+            Byte page = (Byte)(first + i); //Wraps past the end of memory
+            if (!dirty[page]) {
+                dirty[page] = true;
+                Page& saved = checkpoints.back().pages.emplace_back();
+                saved.index = page;
+                memcpy(saved.data, &mem.Data[page * PAGE_SIZE], PAGE_SIZE);
+                bytesUsed += sizeof(Page);
+            }
+        }
+    }
+    //Called by the CPU at the start and end of every Execute call
+    void BeginCall(const Memory& mem, uint64_t retired, i64 budget) {
+        if (replaying) {
+            return;
+        }
+        //Running again after going back replaces the old future
+        if (position < callBase + calls.size()) {
+            if (positionRemaining >= 0) {
+                calls[position - callBase].endRetired = retired;
+                position++;
+            }
+            for (size_t i = position - callBase; i < calls.size(); i++) {
+                bytesUsed -= HostBytes(calls[i]);
+            }
+            calls.erase(calls.begin() + (position - callBase), calls.end());
+        }
+        Call& call = calls.emplace_back(Call{ budget, UINT64_MAX, {} });
+        for (const auto& [address, bytes] : hostRanges) {
+            HostWrite& write = call.hostWrites.emplace_back(HostWrite{ address, std::vector<Byte>(bytes) });
+            for (DWord i = 0; i < bytes; i++) {
+                write.data[i] = mem[(Word)(address + i)];
+            }
+        }
+        bytesUsed += HostBytes(call);
+        hostRanges.clear();
+        currentCall = callBase + calls.size() - 1;
+        inCall = true;
+    }
+    void EndCall(uint64_t retired) {
+        if (replaying) {
+            return;
+        }
+        inCall = false;
+        calls.back().endRetired = retired;
+        position = callBase + calls.size();
+        positionRemaining = -1;
+    }
+
+    uint64_t Oldest() const {
+        return checkpoints.empty() ? UINT64_MAX : checkpoints.front().retired;
+    }
+
+    //Goes back to just before instruction target. False if it is older than the history or not in the past (the CPU is
+    //unchanged), or if re-execution stopped short of it (the CPU is left there), e.g. on host work that bypassed BeforeWrite
+    template<typename CPU>
+    bool RunBackTo(CPU& cpu, Memory& mem, uint64_t target) {
+        if (target >= cpu.retired || target < Oldest()) {
+            return false;
+        }
+        size_t index = checkpoints.size() - 1;
+        while (checkpoints[index].retired > target) {
+            index--;
+        }
+        Restore(cpu, mem, index);
+        ReplayTo(cpu, mem, target);
+        return cpu.retired == target;
+    }
+    template<typename CPU>
+    bool StepBack(CPU& cpu, Memory& mem) {
+        return cpu.retired != 0 && RunBackTo(cpu, mem, cpu.retired - 1);
+    }
+    //Goes back to just before the last instruction that wrote address. False (and the CPU is unchanged) if there is none in the history
+    template<typename CPU>
+    bool RunBackToWrite(CPU& cpu, Memory& mem, Word address) {
+        uint64_t now = cpu.retired;
+        uint64_t end = now;
+        Byte page = address / PAGE_SIZE;
+
+        for (size_t index = checkpoints.size(); index-- > 0;) {
+            if (checkpoints[index].retired >= end) {
+                continue;
+            }
+            bool written = std::any_of(checkpoints[index].pages.begin(), checkpoints[index].pages.end(),
+                [page](const Page& saved) { return saved.index == page; });
+            uint64_t start = checkpoints[index].retired;
+            if (!written) {
+                end = start;
+                continue;
+            }
+
+            //The page was written in this interval, re-execute it watching the address
+            Restore(cpu, mem, index);
+            watching = true;
+            watchHit = false;
+            watchAddress = address;
+            ReplayTo(cpu, mem, end);
+            watching = false;
+
+            if (watchHit) {
+                return RunBackTo(cpu, mem, lastWatchedWrite);
+            }
+            end = start;
+        }
+
+        //Not found, return to where we started
+        if (cpu.retired != now) {
+            ReplayTo(cpu, mem, now);
+        }
+        return false;
+    }
+
+private:
+    std::deque<Call> calls;
+    std::vector<std::pair<Word, DWord>> hostRanges; //Written by the host since the last call
+    bool inCall = false;
+    uint64_t callBase = 0;          //Index of calls.front(), older calls are dropped with their checkpoints
+    uint64_t currentCall = 0;
+    uint64_t position = 0;          //Call to continue re-execution from
+    i64 positionRemaining = -1;     //Its remaining budget, -1 to start it from the beginning
+
+    bool dirty[PAGE_COUNT] = {};
+    uint64_t nextCheckpoint = 0;
+    bool replaying = false;
+    uint64_t stopAt = UINT64_MAX;
+    bool stopped = false;
+    i64 stoppedRemaining = 0;
+
+    bool watching = false;
+    bool watchHit = false;
+    Word watchAddress = 0;
+    uint64_t lastWatchedWrite = 0;
+
+    template<typename CPU>
+    void TakeCheckpoint(CPU& cpu, i64 cycles) {
+        checkpoints.push_back(Checkpoint{ cpu.retired, cpu.Now(cycles), cpu.registers, cpu.halted, cpu.waiting, currentCall, cycles, {} });
+        bytesUsed += sizeof(Checkpoint);
+        memset(dirty, 0, sizeof(dirty));
+        nextCheckpoint = cpu.Now(cycles) + interval;
+
+        while (bytesUsed > memoryBudget && checkpoints.size() > 1) {
+            bytesUsed -= sizeof(Checkpoint) + checkpoints.front().pages.size() * sizeof(Page);
+            checkpoints.pop_front();
+        }
+        while (callBase < checkpoints.front().call) {
+            bytesUsed -= HostBytes(calls.front());
+            calls.pop_front();
+            callBase++;
+        }
+    }
+
+    //Undoes the saved pages from the newest checkpoint down to index and drops the checkpoints after it
+    template<typename CPU>
+    void Restore(CPU& cpu, Memory& mem, size_t index) {
+        for (size_t i = checkpoints.size(); i-- > index;) {
+            for (const Page& saved : checkpoints[i].pages) {
+                memcpy(&mem.Data[saved.index * PAGE_SIZE], saved.data, PAGE_SIZE);
+            }
+            bytesUsed -= checkpoints[i].pages.size() * sizeof(Page);
+            checkpoints[i].pages.clear();
+        }
+        Checkpoint& checkpoint = checkpoints[index];
+        cpu.registers = checkpoint.registers;
+        cpu.halted = checkpoint.halted;
+        cpu.waiting = checkpoint.waiting;
+        cpu.retired = checkpoint.retired;
+        cpu.elapsed = checkpoint.time;
+        position = checkpoint.call;
+        positionRemaining = checkpoint.remaining;
+
+        bytesUsed -= (checkpoints.size() - index - 1) * sizeof(Checkpoint);
+        checkpoints.erase(checkpoints.begin() + index + 1, checkpoints.end());
+        memset(dirty, 0, sizeof(dirty));
+        nextCheckpoint = checkpoint.time + interval;
+        hostRanges.clear(); //They belong to the future that was undone
+    }
+    static size_t HostBytes(const Call& call) {
+        size_t bytes = 0;
+        for (const HostWrite& write : call.hostWrites) {
+            bytes += sizeof(HostWrite) + write.data.size();
+        }
+        return bytes;
+    }
+
+    //Re-executes the logged Execute calls from the current position until the CPU reaches target
+    template<typename CPU>
+    void ReplayTo(CPU& cpu, Memory& mem, uint64_t target) {
+        replaying = true;
+        while (cpu.retired < target && position < callBase + calls.size()) {
+            const Call& call = calls[position - callBase];
+            stopAt = std::min(target, call.endRetired);
+            stopped = false;
+            currentCall = position;
+            if (positionRemaining < 0) {
+                for (const HostWrite& write : call.hostWrites) {
+                    BeforeWrite(mem, write.address, (DWord)write.data.size(), cpu.retired);
+                    for (size_t i = 0; i < write.data.size(); i++) {
+                        mem[(Word)(write.address + i)] = write.data[i];
+                    }
+                }
+            }
+            cpu.Execute(positionRemaining >= 0 ? positionRemaining : call.budget, mem);
+
+            if (stopped && cpu.retired < call.endRetired) {
+                positionRemaining = stoppedRemaining; //Stopped at target inside the call
+                break;
+            }
+            position++;
+            positionRemaining = -1;
+        }
+        stopAt = UINT64_MAX;
+        replaying = false;
+    }
+};
@@ -0,0 +1,219 @@
+#pragma once
+#include <array>
+#include <initializer_list>
+
+/// <summary>
+/// Description of every instruction byte, the one place tools learn the encoding from. Include cpu.h rather than this file.
+///  - OPCODES is indexed by the full instruction byte, so the addressing mode bit is already applied to the operand sizes and length
+///  - Operands are listed in encoding order. Mnemonics and syntax are the assembler's, so decoded instructions reassemble:
+///    the load/store family is "mov", short forms share the long mnemonic and stores are written "mov [address] value"
+///  - CPU::Execute keeps its own switch for speed, a new opcode has to be added there, here and to the assembler.
+///    The DIS-Tests "encoding" test assembles every entry and checks the assembler's opcode selection and length against this table
+/// </summary>
+enum OperandKind : Byte {
+    OPERAND_NONE,
+    OPERAND_REGISTER,   //Register index byte
+    OPERAND_BYTE,       //Unsigned 8 bit immediate
+    OPERAND_WORD,       //16 bit immediate
+    OPERAND_MEMORY,     //Data address, a Word constant or a register byte with the addressing mode bit
+    OPERAND_TARGET,     //New PC, a Word constant or a register byte with the addressing mode bit
+    OPERAND_POINTER,    //Address the new PC is read from (JMPI/JSRI), a Word constant or a register byte with the addressing mode bit
+    OPERAND_RELATIVE,   //Signed 8 bit displacement from the end of the instruction
+};
+//What the addressing mode bit selects
+enum AddressMode : Byte {
+    MODE_NONE,          //Ignored, OPCODES repeats the entry without the bit
+    MODE_MEMORY,
+    MODE_TARGET,
+    MODE_POINTER,
+};
+//How control leaves the instruction, for following control flow
+enum Flow : Byte {
+    FLOW_NEXT,          //Falls through
+    FLOW_BRANCH,        //Falls through or goes to the target
+    FLOW_JUMP,          //Goes to the target
+    FLOW_CALL,          //Goes to the target and comes back to the next instruction
+    FLOW_RETURN,        //Goes to the address on the stack
+    FLOW_STOP,          //HALT, RESET, BRK
+};
+
+struct OpcodeInfo {
+    char mnemonic[8] = {};          //Empty for unassigned instruction bytes. Padded with zeros so it can be copied as a whole
+    Byte mnemonicLength = 0;
+    Byte length = 0;
+    Byte operandCount = 0;
+    OperandKind operands[3] = {};
+    Byte offsets[3] = {};           //From the instruction byte
+    Byte sizes[3] = {};             //1 or 2 bytes
+    AddressMode mode = MODE_NONE;
+    Flow flow = FLOW_NEXT;
+    bool registerMode = false;      //The addressing mode bit is set and selects a register operand
+    bool storeOrder = false;        //Written with the operands swapped, "mov [address] value"
+
+    constexpr bool Valid() const {
+        return mnemonic[0] != '\0';
+    }
+};
+
+constexpr OpcodeInfo OpcodeEntry(const char* mnemonic, std::initializer_list<OperandKind> operands, Flow flow = FLOW_NEXT, bool storeOrder = false) {
+    OpcodeInfo info;
+    while (mnemonic[info.mnemonicLength] != '\0') {
+        info.mnemonic[info.mnemonicLength] = mnemonic[info.mnemonicLength];
+        info.mnemonicLength++;
+    }
+    info.flow = flow;
+    info.storeOrder = storeOrder;
+    for (OperandKind kind : operands) {
+        info.operands[info.operandCount++] = kind;
+        if (kind == OPERAND_MEMORY) {
+            info.mode = MODE_MEMORY;
+        }
+        else if (kind == OPERAND_TARGET) {
+            info.mode = MODE_TARGET;
+        }
+        else if (kind == OPERAND_POINTER) {
+            info.mode = MODE_POINTER;
+        }
+    }
+    return info;
+}
+
+constexpr std::array<OpcodeInfo, 128> MakeBaseOpcodeTable() {
+    constexpr OperandKind R = OPERAND_REGISTER;
+    constexpr OperandKind B = OPERAND_BYTE;
+    constexpr OperandKind W = OPERAND_WORD;
+    constexpr OperandKind M = OPERAND_MEMORY;
+    constexpr OperandKind T = OPERAND_TARGET;
+    constexpr OperandKind P = OPERAND_POINTER;
+    constexpr OperandKind S = OPERAND_RELATIVE;
+
+    std::array<OpcodeInfo, 128> table{};
+    table[OP_NOOP] = OpcodeEntry("noop", {});
+    table[OP_BRK] = OpcodeEntry("brk", {}, FLOW_STOP);
+    table[OP_RESET] = OpcodeEntry("reset", {}, FLOW_STOP);
+    table[OP_HALT] = OpcodeEntry("halt", {}, FLOW_STOP);
+
+    table[OP_ADD] = OpcodeEntry("add", { R, R });
+    table[OP_ADDC] = OpcodeEntry("add", { R, W });
+    table[OP_SUB] = OpcodeEntry("sub", { R, R });
+    table[OP_SUBC] = OpcodeEntry("sub", { R, W });
+    table[OP_MUL] = OpcodeEntry("mul", { R, R });
+    table[OP_MULC] = OpcodeEntry("mul", { R, W });
+    table[OP_DIV] = OpcodeEntry("div", { R, R });
+    table[OP_DIVC] = OpcodeEntry("div", { R, W });
+    table[OP_ADDCB] = OpcodeEntry("add", { R, B });
+    table[OP_SUBCB] = OpcodeEntry("sub", { R, B });
+    table[OP_CMPC] = OpcodeEntry("cmp", { R, W });
+    table[OP_CMPCB] = OpcodeEntry("cmp", { R, B });
+    table[OP_CMP] = OpcodeEntry("cmp", { R, R });
+    table[OP_CMPA] = OpcodeEntry("cmp", { R, M });
+    table[OP_INC] = OpcodeEntry("inc", { R });
+    table[OP_DEC] = OpcodeEntry("dec", { R });
+
+    table[OP_UXT] = OpcodeEntry("uxt", { R });
+    table[OP_LSL] = OpcodeEntry("lsl", { R, W });
+    table[OP_LSR] = OpcodeEntry("lsr", { R, W });
+    table[OP_LSLR] = OpcodeEntry("lsl", { R, R });
+    table[OP_LSRR] = OpcodeEntry("lsr", { R, R });
+    table[OP_ROL] = OpcodeEntry("rol", { R, W });
+    table[OP_ROLR] = OpcodeEntry("rol", { R, R });
+    table[OP_ROR] = OpcodeEntry("ror", { R, W });
+    table[OP_RORR] = OpcodeEntry("ror", { R, R });
+    table[OP_AND] = OpcodeEntry("and", { R, R });
+    table[OP_ANDC] = OpcodeEntry("and", { R, W });
+    table[OP_OR] = OpcodeEntry("or", { R, R });
+    table[OP_ORC] = OpcodeEntry("or", { R, W });
+    table[OP_XOR] = OpcodeEntry("xor", { R, R });
+    table[OP_XORC] = OpcodeEntry("xor", { R, W });
+    table[OP_NOT] = OpcodeEntry("not", { R });
+
+    table[OP_LDR] = OpcodeEntry("mov", { R, R });
+    table[OP_LDC] = OpcodeEntry("mov", { R, W });
+    table[OP_LDM] = OpcodeEntry("mov", { R, M });
+    table[OP_STRM] = OpcodeEntry("mov", { R, M }, FLOW_NEXT, true);
+    table[OP_STCM] = OpcodeEntry("mov", { W, M }, FLOW_NEXT, true);
+    table[OP_LDCB] = OpcodeEntry("mov", { R, B });
+
+    table[OP_BMOV] = OpcodeEntry("bmov", { R, R, R });
+    table[OP_BSET] = OpcodeEntry("bset", { R, R, R });
+    table[OP_BCMP] = OpcodeEntry("bcmp", { R, R, R });
+
+    table[OP_JSR] = OpcodeEntry("jsr", { T }, FLOW_CALL);
+    table[OP_RTN] = OpcodeEntry("rtn", {}, FLOW_RETURN);
+    table[OP_JMP] = OpcodeEntry("jmp", { T }, FLOW_JUMP);
+    table[OP_JRZ] = OpcodeEntry("jrz", { R, T }, FLOW_BRANCH);
+    table[OP_JRE] = OpcodeEntry("jre", { R, W, T }, FLOW_BRANCH);
+    table[OP_JRN] = OpcodeEntry("jrn", { R, W, T }, FLOW_BRANCH);
+    table[OP_JRG] = OpcodeEntry("jrg", { R, W, T }, FLOW_BRANCH);
+    table[OP_JRL] = OpcodeEntry("jrl", { R, W, T }, FLOW_BRANCH);
+    table[OP_JRGE] = OpcodeEntry("jrge", { R, W, T }, FLOW_BRANCH);
+    table[OP_JRLE] = OpcodeEntry("jrle", { R, W, T }, FLOW_BRANCH);
+    table[OP_JMPI] = OpcodeEntry("jmp", { P }, FLOW_JUMP);
+    table[OP_JSRI] = OpcodeEntry("jsr", { P }, FLOW_CALL);
+
+    table[OP_JMPS] = OpcodeEntry("jmp", { S }, FLOW_JUMP);
+    table[OP_JRZS] = OpcodeEntry("jrz", { R, S }, FLOW_BRANCH);
+    table[OP_JRES] = OpcodeEntry("jre", { R, W, S }, FLOW_BRANCH);
+    table[OP_JRNS] = OpcodeEntry("jrn", { R, W, S }, FLOW_BRANCH);
+    table[OP_JRGS] = OpcodeEntry("jrg", { R, W, S }, FLOW_BRANCH);
+    table[OP_JRLS] = OpcodeEntry("jrl", { R, W, S }, FLOW_BRANCH);
+    table[OP_JRGES] = OpcodeEntry("jrge", { R, W, S }, FLOW_BRANCH);
+    table[OP_JRLES] = OpcodeEntry("jrle", { R, W, S }, FLOW_BRANCH);
+    table[OP_BEQ] = OpcodeEntry("beq", { S }, FLOW_BRANCH);
+    table[OP_BNE] = OpcodeEntry("bne", { S }, FLOW_BRANCH);
+    table[OP_BLT] = OpcodeEntry("blt", { S }, FLOW_BRANCH);
+    table[OP_BGE] = OpcodeEntry("bge", { S }, FLOW_BRANCH);
+    table[OP_BCS] = OpcodeEntry("bcs", { S }, FLOW_BRANCH);
+    table[OP_BCC] = OpcodeEntry("bcc", { S }, FLOW_BRANCH);
+    table[OP_BVS] = OpcodeEntry("bvs", { S }, FLOW_BRANCH);
+    table[OP_BVC] = OpcodeEntry("bvc", { S }, FLOW_BRANCH);
+
+    table[OP_PUSH] = OpcodeEntry("push", { R });
+    table[OP_PUSHC] = OpcodeEntry("push", { W });
+    table[OP_POP] = OpcodeEntry("pop", { R });
+    table[OP_PUSHS] = OpcodeEntry("pushs", {});
+    table[OP_POPS] = OpcodeEntry("pops", {});
+    table[OP_PUSHCB] = OpcodeEntry("push", { B });
+
+    table[OP_SEI] = OpcodeEntry("sei", {});
+    table[OP_CLI] = OpcodeEntry("cli", {});
+    table[OP_WAIT] = OpcodeEntry("wait", {});
+    table[OP_RTI] = OpcodeEntry("rti", {}, FLOW_RETURN);
+    table[OP_RDCYC] = OpcodeEntry("rdcyc", { R, R });
+    table[OP_RDCYCH] = OpcodeEntry("rdcych", { R, R });
+    table[OP_RDINST] = OpcodeEntry("rdinst", { R, R });
+    table[OP_RDINSTH] = OpcodeEntry("rdinsth", { R, R });
+    return table;
+}
+
+//Lays out the operands of every entry for both values of the addressing mode bit
+constexpr std::array<OpcodeInfo, 256> MakeOpcodeTable() {
+    std::array<OpcodeInfo, 128> base = MakeBaseOpcodeTable();
+    std::array<OpcodeInfo, 256> table{};
+    for (int instByte = 0; instByte < 256; instByte++) {
+        OpcodeInfo info = base[instByte & 0x7F];
+        if (!info.Valid()) {
+            continue;
+        }
+        info.registerMode = (instByte & 0x80) != 0 && info.mode != MODE_NONE;
+        Byte offset = 1;
+        for (Byte i = 0; i < info.operandCount; i++) {
+            OperandKind kind = info.operands[i];
+            bool word = kind == OPERAND_WORD || (!info.registerMode && (kind == OPERAND_MEMORY || kind == OPERAND_TARGET || kind == OPERAND_POINTER));
+            info.offsets[i] = offset;
+            info.sizes[i] = word ? 2 : 1;
+            offset += info.sizes[i];
+        }
+        info.length = offset;
+        table[instByte] = info;
+    }
+    return table;
+}
+
+inline constexpr std::array<OpcodeInfo, 256> OPCODES = MakeOpcodeTable();
+
+//Spot checks against the operand fetches in CPU::Execute
+static_assert(OPCODES[OP_HALT].length == 1 && OPCODES[OP_ADDC].length == 4 && OPCODES[OP_ADDCB].length == 3);
+static_assert(OPCODES[OP_LDM].length == 4 && OPCODES[OP_LDM | 0x80].length == 3 && OPCODES[OP_STCM | 0x80].length == 4);
+static_assert(OPCODES[OP_JRN].length == 6 && OPCODES[OP_JRN | 0x80].length == 5 && OPCODES[OP_JRNS].length == 5);
+static_assert(OPCODES[OP_JMPI | 0x80].length == 2 && OPCODES[OP_BEQ | 0x80].length == 2 && OPCODES[OP_BMOV].length == 4);
@@ -0,0 +1,187 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "symbols.h"
+
+/// <summary>
+/// Instruction level profiler for CPU::Execute. Include cpu.h rather than this file.
+///  - Only compiled into CPU when DIS_PROFILER is defined, otherwise Execute has no profiling code at all
+///  - Every executed instruction is counted (no sampling) in flat arrays indexed by its address
+///  - Calls are attributed through a shadow stack driven by JSR/JSRI, interrupts and RTN
+/// </summary>
+struct Profiler
+{
+    struct FunctionStats {
+        uint64_t calls = 0;
+        uint64_t selfCycles = 0;
+        uint64_t inclusiveCycles = 0; //Recursive calls only count the outermost activation
+    };
+    struct EdgeStats {
+        uint64_t calls = 0;
+        uint64_t inclusiveCycles = 0;
+    };
+    struct Frame {
+        Word function; //Entry address
+        uint64_t startCycles;
+        uint64_t childCycles;
+    };
+
+    std::vector<uint64_t> instructionCounts = std::vector<uint64_t>(Memory::MEM_SIZE); //Indexed by PC
+    std::vector<uint64_t> cycleCounts = std::vector<uint64_t>(Memory::MEM_SIZE); //Indexed by PC
+    uint64_t opcodeCounts[256] = {}; //Indexed by the full instruction byte so both addressing modes are separate
+    uint64_t opcodeCycles[256] = {};
+
+    std::map<Word, FunctionStats> functions;
+    std::map<std::pair<Word, Word>, EdgeStats> edges; //(caller, callee) entry addresses
+
+    std::vector<Frame> callStack;
+    uint64_t totalInstructions = 0;
+    uint64_t totalCycles = 0;
+
+    explicit Profiler(Word entry = 0) {
+        callStack.push_back(Frame{ entry, 0, 0 });
+    }
+
+    //Called by CPU::Execute after every instruction
+    void Record(Word pc, Byte instByte, i64 cycles, Word newPC) {
+        instructionCounts[pc]++;
+        cycleCounts[pc] += cycles;
+        opcodeCounts[instByte]++;
+        opcodeCycles[instByte] += cycles;
+        totalInstructions++;
+        totalCycles += cycles;
+
+        switch ((Opcode)(instByte & 0x7F))
+        {
+        case OP_JSR:
+        case OP_JSRI:
+            Call(newPC);
+            break;
+        case OP_RTN:
+        case OP_RTI:
+            Return();
+            break;
+        default:
+            break;
+        }
+    }
+    //Called by CPU::ExecuteInterrupt, the handler is attributed like a called function
+    void RecordInterrupt(i64 cycles, Word handler) {
+        totalCycles += cycles;
+        Call(handler);
+    }
+
+    void Call(Word function) {
+        callStack.push_back(Frame{ function, totalCycles, 0 });
+    }
+    void Return() {
+        if (callStack.size() <= 1) {
+            return; //RTN without a matching call, keep the root frame
+        }
+
+        Frame frame = callStack.back();
+        callStack.pop_back();
+        Frame& caller = callStack.back();
+
+        uint64_t inclusive = totalCycles - frame.startCycles;
+        bool recursive = std::any_of(callStack.begin(), callStack.end(),
+            [&frame](const Frame& f) { return f.function == frame.function; });
+
+        FunctionStats& stats = functions[frame.function];
+        stats.calls++;
+        stats.selfCycles += inclusive - frame.childCycles;
+        if (!recursive) {
+            stats.inclusiveCycles += inclusive;
+        }
+
+        EdgeStats& edge = edges[{ caller.function, frame.function }];
+        edge.calls++;
+        edge.inclusiveCycles += inclusive;
+
+        caller.childCycles += inclusive;
+    }
+
+    //Writes "0xADDR count" for every executed address, the profile DIS-Assembler -profile lays labels out by
+    bool SaveCounts(const std::string& filename) const {
+        FILE* file = std::fopen(filename.c_str(), "w");
+        if (file == nullptr) {
+            return false;
+        }
+        for (DWord pc = 0; pc < Memory::MEM_SIZE; pc++) {
+            if (instructionCounts[pc] != 0) {
+                std::fprintf(file, "0x%04X %llu\n", pc, (unsigned long long)instructionCounts[pc]);
+            }
+        }
+        std::fclose(file);
+        return true;
+    }
+
+    void Report(const SymbolMap& symbols, size_t top = 20) const {
+        printf("\nPROFILE:\n");
+        printf("Instructions:       %llu\n", (unsigned long long)totalInstructions);
+        printf("Cycles:             %llu\n", (unsigned long long)totalCycles);
+
+        //Hottest addresses
+        std::vector<Word> pcs;
+        for (DWord pc = 0; pc < Memory::MEM_SIZE; pc++) {
+            if (instructionCounts[pc] != 0) {
+                pcs.push_back((Word)pc);
+            }
+        }
+        std::sort(pcs.begin(), pcs.end(), [this](Word a, Word b) { return cycleCounts[a] > cycleCounts[b]; });
+
+        printf("\nHot instructions (by cycles):\n");
+        printf("  %-24s %12s %12s %7s\n", "Address", "Executed", "Cycles", "%");
+        for (size_t i = 0; i < pcs.size() && i < top; i++) {
+            Word pc = pcs[i];
+            printf("  %-24s %12llu %12llu %6.2f%%\n", symbols.Symbolize(pc).c_str(),
+                (unsigned long long)instructionCounts[pc], (unsigned long long)cycleCounts[pc], Percent(cycleCounts[pc]));
+        }
+
+        //Flat profile per label
+        std::map<std::string, std::pair<uint64_t, uint64_t>> labels;
+        for (Word pc : pcs) {
+            auto label = symbols.Find(pc);
+            auto& totals = labels[label != nullptr ? label->second : "<unknown>"];
+            totals.first += instructionCounts[pc];
+            totals.second += cycleCounts[pc];
+        }
+        std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>> sortedLabels(labels.begin(), labels.end());
+        std::sort(sortedLabels.begin(), sortedLabels.end(), [](const auto& a, const auto& b) { return a.second.second > b.second.second; });
+
+        printf("\nLabels (by cycles):\n");
+        printf("  %-24s %12s %12s %7s\n", "Label", "Executed", "Cycles", "%");
+        for (auto& [name, totals] : sortedLabels) {
+            printf("  %-24s %12llu %12llu %6.2f%%\n", name.c_str(),
+                (unsigned long long)totals.first, (unsigned long long)totals.second, Percent(totals.second));
+        }
+
+        printf("\nOpcodes:\n");
+        printf("  %-8s %-8s %12s %12s\n", "Opcode", "Mnemonic", "Executed", "Cycles");
+        for (int op = 0; op < 256; op++) {
+            if (opcodeCounts[op] != 0) {
+                printf("  0x%02X     %-8s %12llu %12llu\n", op, OPCODES[op].Valid() ? OPCODES[op].mnemonic : "?",
+                    (unsigned long long)opcodeCounts[op], (unsigned long long)opcodeCycles[op]);
+            }
+        }
+
+        printf("\nFunctions (completed calls):\n");
+        printf("  %-24s %10s %12s %12s\n", "Function", "Calls", "Self", "Inclusive");
+        for (auto& [function, stats] : functions) {
+            printf("  %-24s %10llu %12llu %12llu\n", symbols.Symbolize(function).c_str(),
+                (unsigned long long)stats.calls, (unsigned long long)stats.selfCycles, (unsigned long long)stats.inclusiveCycles);
+        }
+
+        printf("\nCall graph:\n");
+        for (auto& [edge, stats] : edges) {
+            printf("  %s -> %s: %llu calls, %llu cycles\n", symbols.Symbolize(edge.first).c_str(), symbols.Symbolize(edge.second).c_str(),
+                (unsigned long long)stats.calls, (unsigned long long)stats.inclusiveCycles);
+        }
+    }
+
+private:
+    double Percent(uint64_t cycles) const {
+        return totalCycles == 0 ? 0.0 : 100.0 * cycles / totalCycles;
+    }
+};
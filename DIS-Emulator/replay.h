@@ -0,0 +1,189 @@
+#pragma once
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Log of the nondeterministic inputs of a run, for deterministic record/replay. Include cpu.h rather than this file.
+///  - Only inputs are logged: interrupts at the time CPU::ExecuteInterrupt delivered them and the bytes devices wrote into
+///    memory, so the log grows with the number of events instead of the number of instructions. Devices are memory mapped,
+///    so this covers both their transfers and their register values
+///  - Times are CPU::Now(), cycles (instructions without CycleExact) since the CPU was constructed
+///  - Replay starts from the same program and CPU state. Interrupts raised with SetInterrupt are ignored and the logged ones
+///    are delivered at the same times. Logged device writes are copied into memory at the instruction boundary at their time,
+///    the devices themselves stay idle. Block instructions split at the Execute budget, so use the same budgets as the recording
+/// </summary>
+struct InputLog
+{
+    enum Mode : Byte {
+        RECORD,
+        REPLAY,
+    };
+    enum EventKind : Byte {
+        EVENT_INTERRUPT = 0,    //id is the interrupt number (0-6, 7 for the high priority interrupt)
+        EVENT_WRITE = 1,        //id is the device, value is the address and data the bytes it wrote there
+    };
+    struct Event {
+        uint64_t time;
+        EventKind kind;
+        Byte id;
+        Word value;
+        std::vector<Byte> data;
+    };
+
+    static constexpr char MAGIC[4] = { 'D', 'I', 'N', 'L' };
+    static constexpr Byte VERSION = 2;
+
+    Mode mode = RECORD;
+    std::vector<Event> events;
+    size_t next = 0; //Next event to replay
+
+    void StartRecording() {
+        mode = RECORD;
+        events.clear();
+        next = 0;
+    }
+    void StartReplay() {
+        mode = REPLAY;
+        next = 0;
+    }
+    bool Replaying() const {
+        return mode == REPLAY;
+    }
+    bool Finished() const {
+        return mode == REPLAY && next == events.size();
+    }
+    //Time of the next event to replay, CPU::FastForward must not skip past it
+    uint64_t NextEventTime() const {
+        return next == events.size() ? UINT64_MAX : events[next].time;
+    }
+
+    //Called by CPU::ExecuteInterrupt while recording
+    void RecordInterrupt(uint64_t time, Byte interrupt) {
+        events.push_back(Event{ time, EVENT_INTERRUPT, interrupt, 0, {} });
+    }
+    //Called by the CPU at every instruction boundary while replaying. Returns the interrupt to deliver now, or -1
+    int ReplayInterrupt(uint64_t time) {
+        if (next == events.size()) {
+            return -1;
+        }
+        const Event& event = events[next];
+        if (event.time < time) {
+            throw std::runtime_error("ERROR: Replay diverged from the input log\n");
+        }
+        if (event.time != time || event.kind != EVENT_INTERRUPT) {
+            return -1;
+        }
+        next++;
+        return event.id;
+    }
+
+    //Devices call it outside Execute after writing guest memory while recording. Memory wraps past 0xFFFF
+    void RecordWrite(uint64_t time, Byte device, const Memory& mem, Word address, DWord bytes) {
+        Event& event = events.emplace_back(Event{ time, EVENT_WRITE, device, address, std::vector<Byte>(bytes) });
+        for (DWord i = 0; i < bytes; i++) {
+            event.data[i] = mem[(Word)(address + i)];
+        }
+    }
+    //Called by the CPU at every instruction boundary while replaying, before ReplayInterrupt. Copies the device writes logged
+    //for this time into memory like the device did
+    template<typename CPU>
+    void ReplayWrites(CPU& cpu, i64& cycles, Memory& mem, uint64_t time) {
+        while (next < events.size() && events[next].time == time && events[next].kind == EVENT_WRITE) {
+            const Event& event = events[next++];
+            DWord bytes = (DWord)event.data.size();
+            cpu.BeforeWrite(mem, event.value, bytes);
+            for (DWord i = 0; i < bytes; i++) {
+                mem[(Word)(event.value + i)] = event.data[i];
+            }
+            cpu.TraceBlock(event.value, bytes);
+            cpu.Watch(cycles, mem, event.value, bytes, Memory::PAGE_WATCH_WRITE | Memory::PAGE_BREAKPOINT);
+        }
+    }
+
+    //Times are stored as varint deltas from the previous event
+    bool Save(const std::string& filename) const {
+        FILE* file = std::fopen(filename.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        std::vector<Byte> data(MAGIC, MAGIC + sizeof(MAGIC));
+        data.push_back(VERSION);
+
+        Byte buffer[24];
+        Byte* end = TraceFormat::PutVarint(buffer, events.size());
+        data.insert(data.end(), buffer, end);
+
+        uint64_t time = 0;
+        for (const Event& event : events) {
+            end = TraceFormat::PutVarint(buffer, event.time - time);
+            *end++ = event.kind;
+            *end++ = event.id;
+            if (event.kind == EVENT_WRITE) {
+                end = TraceFormat::PutVarint(end, event.value);
+                end = TraceFormat::PutVarint(end, event.data.size());
+            }
+            data.insert(data.end(), buffer, end);
+            data.insert(data.end(), event.data.begin(), event.data.end());
+            time = event.time;
+        }
+
+        bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+        std::fclose(file);
+        return written;
+    }
+    bool Load(const std::string& filename) {
+        FILE* file = std::fopen(filename.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        std::vector<Byte> data;
+        Byte buffer[4096];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) != 0) {
+            data.insert(data.end(), buffer, buffer + read);
+        }
+        std::fclose(file);
+
+        if (data.size() < sizeof(MAGIC) + 1 || memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0 || data[sizeof(MAGIC)] != VERSION) {
+            return false;
+        }
+        const Byte* in = data.data() + sizeof(MAGIC) + 1;
+        const Byte* end = data.data() + data.size();
+
+        uint64_t count;
+        if ((in = TraceFormat::GetVarint(in, end, count)) == nullptr) {
+            return false;
+        }
+        events.clear();
+        uint64_t time = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t delta;
+            uint64_t value = 0;
+            if ((in = TraceFormat::GetVarint(in, end, delta)) == nullptr || end - in < 2) {
+                return false;
+            }
+            EventKind kind = (EventKind)in[0];
+            Byte id = in[1];
+            in += 2;
+            if (kind > EVENT_WRITE) {
+                return false;
+            }
+            std::vector<Byte> written;
+            if (kind == EVENT_WRITE) {
+                uint64_t bytes;
+                if ((in = TraceFormat::GetVarint(in, end, value)) == nullptr || (in = TraceFormat::GetVarint(in, end, bytes)) == nullptr
+                    || bytes > Memory::MEM_SIZE || (uint64_t)(end - in) < bytes) {
+                    return false;
+                }
+                written.assign(in, in + bytes);
+                in += bytes;
+            }
+            time += delta;
+            events.push_back(Event{ time, kind, id, (Word)value, std::move(written) });
+        }
+        next = 0;
+        return true;
+    }
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <fstream>
+#include <iterator>
+
+/// <summary>
+/// Label addresses of an assembled program.
+/// The assembler writes them next to the program image as "0x0000 .main" lines so emulator side tools
+/// (profiler, trace reader, disassembler) can print label+offset instead of raw addresses
+/// </summary>
+struct SymbolMap
+{
+    std::map<uint16_t, std::string> labels; //Address -> label name
+
+    void Add(uint16_t address, const std::string& name) {
+        labels.emplace(address, name); //Empty labels share an address with the next one, the first name wins
+    }
+
+    //Label whose code contains the address, nullptr if the address is before the first label
+    const std::pair<const uint16_t, std::string>* Find(uint16_t address) const {
+        auto itr = labels.upper_bound(address);
+        if (itr == labels.begin()) {
+            return nullptr;
+        }
+        return &*std::prev(itr);
+    }
+
+    std::string Symbolize(uint16_t address) const {
+        char buffer[16];
+        auto label = Find(address);
+        if (label == nullptr) {
+            std::snprintf(buffer, sizeof(buffer), "0x%04X", address);
+            return buffer;
+        }
+        if (label->first == address) {
+            return label->second;
+        }
+        std::snprintf(buffer, sizeof(buffer), "+0x%X", address - label->first);
+        return label->second + buffer;
+    }
+
+    bool Save(const std::string& filename) const {
+        std::ofstream outfile(filename, std::ios::out);
+        char address[8];
+        for (auto& [labelAddress, name] : labels) {
+            std::snprintf(address, sizeof(address), "0x%04X", labelAddress);
+            outfile << address << ' ' << name << '\n';
+        }
+        return outfile.good();
+    }
+
+    bool Load(const std::string& filename) {
+        std::ifstream infile(filename);
+        std::string address;
+        std::string name;
+        while (infile >> address >> name) {
+            Add(static_cast<uint16_t>(std::stoul(address, nullptr, 16)), name);
+        }
+        return !labels.empty();
+    }
+};
@@ -0,0 +1,766 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Retire runs after every instruction but the CPU loop is too large for the compiler to inline it on its own
+#ifdef _MSC_VER
+#define DIS_FORCE_INLINE __forceinline
+#else
+#define DIS_FORCE_INLINE inline __attribute__((always_inline))
+#endif
+
+/// <summary>
+/// Binary execution trace. Include cpu.h rather than this file.
+///  - One record per retired instruction or interrupt entry, delta encoded against the previous record:
+///    the PC is implied by the previous record's next PC and only changed registers and memory writes are stored
+///  - The CPU thread copies raw records into a lock-free single producer/single consumer ring owned by its TraceRecorder,
+///    a background thread delta encodes and compresses them in blocks and streams them to disk
+///  - TraceReader decodes the file back into TraceRecords. DIS-Trace is the command line reader
+/// </summary>
+struct TraceFormat
+{
+    /*
+        File:   "DTRC" | version | blocks...
+        Block:  raw size (4 bytes) | compressed size (4 bytes) | compressed data
+        Record: tag | opcode | next PC delta | cycles | [PC delta] | [register mask | register deltas] | [write count | writes] | [block]
+
+        Numbers are little endian varints, signed deltas are zigzag encoded.
+        Memory writes store the address delta from the previous write (shifted left once, bit 0 set for byte writes) and the raw value.
+        Block instructions and RESET only store the written range, their contents follow from the registers and earlier writes.
+    */
+    static constexpr char MAGIC[4] = { 'D', 'T', 'R', 'C' };
+    static constexpr Byte VERSION = 1;
+
+    //Tag bits
+    static constexpr Byte KIND_MASK = 0x03;
+    static constexpr Byte EXPLICIT_PC = 0x04;   //The record does not start at the previous record's next PC
+    static constexpr Byte REGISTERS = 0x08;
+    static constexpr Byte WRITES = 0x10;
+    static constexpr Byte BLOCK = 0x20;
+
+    //Register mask bits 0-5 are R0-R5, the PC is covered by the next PC delta
+    static constexpr Word MASK_SP = 1 << 6;
+    static constexpr Word MASK_STATUS = 1 << 7;
+    static constexpr Word MASK_INTERRUPTS = 1 << 8;
+
+    static constexpr size_t MAX_WRITES = 4; //An interrupt entry pushes two words, no instruction writes more than one
+    //Tag, opcode, next PC, cycles, PC, register mask, 7 register deltas, status, interrupt flags, write count, writes, block
+    static constexpr size_t MAX_RECORD_SIZE = 1 + 1 + 3 + 10 + 3 + 2 + 7 * 3 + 1 + 1 + 1 + MAX_WRITES * 5 + 2 + 5;
+
+    static Byte* PutVarint(Byte* out, uint64_t value) {
+        while (value >= 0x80) {
+            *out++ = (Byte)(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = (Byte)value;
+        return out;
+    }
+    static Byte* PutDelta(Byte* out, int64_t delta) {
+        return PutVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    }
+    //Returns nullptr when the varint runs past end
+    static const Byte* GetVarint(const Byte* in, const Byte* end, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; in < end && shift < 64; shift += 7) {
+            Byte b = *in++;
+            value |= (uint64_t)(b & 0x7F) << shift;
+            if ((b & 0x80) == 0) {
+                return in;
+            }
+        }
+        return nullptr;
+    }
+    static const Byte* GetDelta(const Byte* in, const Byte* end, int64_t& delta) {
+        uint64_t value;
+        in = GetVarint(in, end, value);
+        delta = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        return in;
+    }
+    static Word WordDelta(Word from, Word to) {
+        return to - from;
+    }
+
+    //LZ77 block compression. A sequence is a token (literal length << 4 | match length - 4), the literals and a 16 bit
+    //match offset. Lengths of 15 or more continue in a varint. The last sequence of a block only has literals
+    static constexpr size_t MIN_MATCH = 4;
+    static constexpr int HASH_BITS = 14;
+
+    static void Compress(const Byte* in, size_t size, std::vector<Byte>& out, std::vector<uint32_t>& table) {
+        table.assign((size_t)1 << HASH_BITS, UINT32_MAX);
+        out.clear();
+        out.reserve(size + size / 8 + 16);
+
+        size_t anchor = 0;
+        size_t i = 0;
+        while (i + MIN_MATCH <= size) {
+            uint32_t sequence;
+            memcpy(&sequence, in + i, MIN_MATCH);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+            uint32_t candidate = table[hash];
+            table[hash] = (uint32_t)i;
+
+            if (candidate == UINT32_MAX || i - candidate > 0xFFFF || memcmp(in + candidate, in + i, MIN_MATCH) != 0) {
+                i++;
+                continue;
+            }
+
+            size_t length = MIN_MATCH;
+            while (i + length < size && in[candidate + length] == in[i + length]) {
+                length++;
+            }
+            EmitSequence(out, in + anchor, i - anchor, length);
+            out.push_back((Byte)(i - candidate));
+            out.push_back((Byte)((i - candidate) >> 8));
+
+            i += length;
+            anchor = i;
+        }
+        EmitSequence(out, in + anchor, size - anchor, 0);
+    }
+    static bool Decompress(const Byte* in, size_t size, std::vector<Byte>& out) {
+        const Byte* end = in + size;
+        while (in < end) {
+            Byte token = *in++;
+            uint64_t literals = token >> 4;
+            if (literals == 15) {
+                uint64_t extra;
+                if ((in = GetVarint(in, end, extra)) == nullptr) {
+                    return false;
+                }
+                literals += extra;
+            }
+            if ((uint64_t)(end - in) < literals) {
+                return false;
+            }
+            out.insert(out.end(), in, in + literals);
+            in += literals;
+            if (in == end) {
+                return true; //Literal only sequence ends the block
+            }
+
+            uint64_t length = (token & 0x0F) + MIN_MATCH;
+            if ((token & 0x0F) == 15) {
+                uint64_t extra;
+                if ((in = GetVarint(in, end, extra)) == nullptr) {
+                    return false;
+                }
+                length += extra;
+            }
+            if (end - in < 2) {
+                return false;
+            }
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            if (offset == 0 || offset > out.size()) {
+                return false;
+            }
+            size_t from = out.size() - offset;
+            for (uint64_t n = 0; n < length; n++) { //Byte by byte, matches may overlap their own output
+                out.push_back(out[from + n]);
+            }
+        }
+        return true;
+    }
+
+private:
+    static void EmitSequence(std::vector<Byte>& out, const Byte* literals, size_t literalCount, size_t matchLength) {
+        Byte buffer[24];
+        Byte* end = buffer + 1;
+        size_t matchCode = matchLength == 0 ? 0 : matchLength - MIN_MATCH;
+        buffer[0] = (Byte)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+        if (literalCount >= 15) {
+            end = PutVarint(end, literalCount - 15);
+        }
+        out.insert(out.end(), buffer, end);
+        out.insert(out.end(), literals, literals + literalCount);
+
+        if (matchLength != 0 && matchCode >= 15) {
+            end = PutVarint(buffer, matchCode - 15);
+            out.insert(out.end(), buffer, end);
+        }
+    }
+};
+
+/// <summary>
+/// A decoded trace record. Registers hold the full CPU state after the record
+/// </summary>
+struct TraceRecord
+{
+    enum Kind : Byte {
+        INSTRUCTION = 0,
+        INTERRUPT = 1,  //Interrupt entry, opcode holds the interrupt number
+        SNAPSHOT = 2,   //Full register state, written when recording starts
+    };
+    struct MemoryWrite {
+        Word address;
+        Word value;
+        bool isByte;
+    };
+
+    Kind kind = INSTRUCTION;
+    Byte opcode = 0;
+    Word pc = 0;        //Address of the instruction, or the PC the interrupt was taken at
+    Word nextPC = 0;
+    uint64_t cycles = 0;
+    Word changedRegisters = 0; //TraceFormat register mask
+    Registers registers{};
+
+    std::vector<MemoryWrite> writes;
+    bool hasBlock = false;
+    Word blockAddress = 0;
+    DWord blockBytes = 0;
+};
+
+/// <summary>
+/// Lock-free byte ring with one producer (the CPU thread) and one consumer (the TraceRecorder writer thread).
+/// Capacity must be a power of two. The buffer has MAX_ENTRY_SIZE bytes of slack past the end so entries are
+/// written in place and only an entry that crosses the end is copied (to the start of the ring).
+/// An entry is a chunk of records, the producer fills it in place and commits the part it used
+/// </summary>
+struct TraceRing
+{
+    static constexpr size_t MAX_ENTRY_SIZE = 4096;
+
+    std::vector<Byte> buffer;
+    size_t capacity;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> head{ 0 }; //Total bytes committed, only written by the producer
+    size_t cachedTail = 0;                      //Producer's last view of tail, refreshed only when the ring looks full
+    alignas(64) std::atomic<size_t> tail{ 0 }; //Total bytes popped, only written by the consumer
+
+    explicit TraceRing(size_t capacity) : buffer(capacity + MAX_ENTRY_SIZE), capacity(capacity), mask(capacity - 1) {
+    }
+
+    //Space for one entry at the head, nullptr while the ring is full
+    Byte* Reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (capacity - (h - cachedTail) < MAX_ENTRY_SIZE) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (capacity - (h - cachedTail) < MAX_ENTRY_SIZE) {
+                return nullptr;
+            }
+        }
+        return &buffer[h & mask];
+    }
+    void Commit(size_t size) {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t offset = h & mask;
+        if (offset + size > capacity) {
+            memcpy(&buffer[0], &buffer[capacity], offset + size - capacity);
+        }
+        head.store(h + size, std::memory_order_release);
+    }
+    size_t Pop(Byte* out, size_t maxSize) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t size = std::min(maxSize, head.load(std::memory_order_acquire) - t);
+        size_t offset = t & mask;
+        size_t first = std::min(size, capacity - offset);
+        memcpy(out, &buffer[offset], first);
+        memcpy(out + first, &buffer[0], size - first);
+        tail.store(t + size, std::memory_order_release);
+        return size;
+    }
+};
+
+/// <summary>
+/// Records the execution of one CPU into a trace file. Attach with cpu.tracer, only used when Policy::Tracing is set.
+/// The CPU thread writes fixed layout records straight into a chunk of the ring and commits the chunk once it is full, so
+/// a record costs a few stores. Delta encoding and compression run on the writer thread, which sees records a chunk at a time.
+/// The CPU blocks (counted in stalls) instead of dropping records when the writer thread falls behind
+/// </summary>
+struct TraceRecorder
+{
+    static constexpr size_t BLOCK_SIZE = 1 << 16; //Uncompressed bytes per file block
+
+    uint64_t records = 0;
+    uint64_t stalls = 0;        //Times the CPU waited for the writer thread
+    uint64_t droppedWrites = 0; //Memory writes past MAX_WRITES in one record
+    std::atomic<uint64_t> encodedBytes{ 0 };
+    std::atomic<uint64_t> fileBytes{ 0 };
+
+    explicit TraceRecorder(size_t ringSize = 1 << 22) : ring(ringSize) {
+    }
+    ~TraceRecorder() {
+        Stop();
+    }
+
+    //Opens the file and records a snapshot of the current registers
+    bool Start(const std::string& filename, const Registers& registers) {
+        Stop();
+        file = std::fopen(filename.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        std::fwrite(TraceFormat::MAGIC, 1, sizeof(TraceFormat::MAGIC), file);
+        std::fputc(TraceFormat::VERSION, file);
+        fileBytes = sizeof(TraceFormat::MAGIC) + 1;
+        encodedBytes = 0;
+        pending = 0;
+
+        chunk = cursor = ring.Reserve(); //The writer thread drained the ring
+        chunkLimit = chunk + TraceRing::MAX_ENTRY_SIZE - MAX_RAW_SIZE;
+        Retire(TraceRecord::SNAPSHOT, registers.PC, 0, 0, registers);
+        records = 0;
+        stalls = 0;
+
+        stopping = false;
+        writer = std::thread(&TraceRecorder::WriterLoop, this);
+        return true;
+    }
+    //Drains the ring and closes the file
+    void Stop() {
+        if (writer.joinable()) {
+            ring.Commit(cursor - chunk);
+            chunk = cursor;
+            stopping = true;
+            writer.join();
+        }
+        if (file != nullptr) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    //Called by the CPU for every memory write of the current instruction, written behind the record's slot
+    void MemoryWrite(Word address, Word value, bool isByte) {
+        Byte count = pending & 0xFF;
+        if (count == TraceFormat::MAX_WRITES) {
+            droppedWrites++;
+            return;
+        }
+        RawWrite write{ address, value };
+        memcpy(cursor + sizeof(RawRecord) + count * sizeof(RawWrite), &write, sizeof(write));
+        pending += 1 | isByte << (count + 8);
+    }
+    //Called by the CPU for block instructions and RESET
+    void BlockWrite(Word address, DWord bytes) {
+        pending |= RAW_BLOCK << 8;
+        block = RawBlock{ address, bytes };
+    }
+    //Called by the CPU after every instruction and interrupt entry. The record holds all registers, the writer thread
+    //finds the changed ones. Inlined into the CPU loop, blocks and full chunks are handled out of line
+    DIS_FORCE_INLINE void Retire(TraceRecord::Kind kind, Word pc, Byte opcode, i64 cycles, const Registers& registers) {
+        //The instruction just stored some registers as Words. Loading those bytes with a wider load stalls until the stores
+        //retire (no store forwarding), volatile keeps the compiler from merging the Word loads
+        const volatile Word* source = registers.aligned;
+        uint64_t low = source[0] | (uint64_t)source[1] << 16 | (uint64_t)source[2] << 32 | (uint64_t)source[3] << 48;
+        uint64_t high = source[4] | (uint64_t)source[5] << 16 | (uint64_t)source[6] << 32 | (uint64_t)source[7] << 48;
+        uint64_t rest = (uint64_t)registers.status | (uint64_t)registers.interruptFlags << 8 | (uint64_t)pc << 16 | (uint64_t)(DWord)cycles << 32;
+        uint32_t tail = kind | opcode << 8 | (uint32_t)pending << 16;
+
+        Byte* out = cursor;
+        memcpy(out, &low, sizeof(low));
+        memcpy(out + 8, &high, sizeof(high));
+        memcpy(out + offsetof(RawRecord, status), &rest, sizeof(rest));
+        memcpy(out + offsetof(RawRecord, kind), &tail, sizeof(tail));
+        out += sizeof(RawRecord) + (pending & 0xFF) * sizeof(RawWrite); //The writes are already in place
+        records++;
+        if (out > chunkLimit || (pending & RAW_BLOCK << 8)) {
+            FinishRecord(out);
+        }
+        else {
+            cursor = out;
+        }
+        pending = 0;
+    }
+
+private:
+    //Record in a ring chunk: a RawRecord followed by writeCount RawWrites and a RawBlock when RAW_BLOCK is set
+    struct RawRecord {
+        Word registers[8];   //Registers::aligned after the instruction, the PC is the next PC
+        Byte status;
+        Byte interruptFlags;
+        Word pc;
+        DWord cycles;
+        Byte kind;
+        Byte opcode;
+        Byte writeCount;
+        Byte flags;          //Bits 0-3 mark byte writes
+    };
+    struct RawWrite {
+        Word address;
+        Word value;
+    };
+    struct RawBlock {
+        Word address;
+        DWord bytes;
+    };
+    static constexpr Byte RAW_BLOCK = 0x80;
+    static constexpr size_t MAX_RAW_SIZE = sizeof(RawRecord) + TraceFormat::MAX_WRITES * sizeof(RawWrite) + sizeof(RawBlock);
+    static_assert(offsetof(RawRecord, pc) == 18 && offsetof(RawRecord, cycles) == 20 && offsetof(RawRecord, flags) == 27 && sizeof(RawRecord) == 28,
+        "Retire writes RawRecord in four pieces");
+
+    TraceRing ring;
+    std::thread writer;
+    std::atomic<bool> stopping{ false };
+    FILE* file = nullptr;
+
+    //Chunk being filled and the current instruction, only touched by the CPU thread
+    Byte* chunk = nullptr;
+    Byte* cursor = nullptr;     //Slot of the next record
+    Byte* chunkLimit = nullptr; //Past it the next record might not fit
+    Word pending = 0;           //RawRecord::writeCount and RawRecord::flags of the current instruction
+    RawBlock block{};
+
+    //Delta state, only touched by the writer thread
+    Registers last{};
+    Word expectedPC = 0;
+    Word lastWriteAddress = 0;
+
+    //Out of line part of Retire: appends the block and moves to the next chunk when this one is full
+    void FinishRecord(Byte* out) {
+        if (pending & RAW_BLOCK << 8) {
+            memcpy(out, &block, sizeof(block));
+            out += sizeof(block);
+        }
+        cursor = out;
+        if (out > chunkLimit) {
+            NextChunk();
+        }
+    }
+    void NextChunk() {
+        ring.Commit(cursor - chunk);
+        chunk = ring.Reserve();
+        while (chunk == nullptr) {
+            stalls++;
+            std::this_thread::yield();
+            chunk = ring.Reserve();
+        }
+        cursor = chunk;
+        chunkLimit = chunk + TraceRing::MAX_ENTRY_SIZE - MAX_RAW_SIZE;
+    }
+
+    //Delta encodes one ring entry, returns the entry size or 0 if it is incomplete
+    size_t Encode(const Byte* entry, size_t available, std::vector<Byte>& out) {
+        RawRecord raw;
+        if (available < sizeof(raw)) {
+            return 0;
+        }
+        memcpy(&raw, entry, sizeof(raw));
+        size_t size = sizeof(raw) + raw.writeCount * sizeof(RawWrite) + ((raw.flags & RAW_BLOCK) ? sizeof(RawBlock) : 0);
+        if (available < size) {
+            return 0;
+        }
+
+        size_t start = out.size();
+        out.resize(start + TraceFormat::MAX_RECORD_SIZE);
+        Byte* record = &out[start];
+        Byte* end = record + 1;
+
+        Registers registers{};
+        const Byte* payload = entry + sizeof(raw);
+        memcpy(registers.aligned, raw.registers, sizeof(registers.aligned));
+        registers.status = raw.status;
+        registers.interruptFlags = raw.interruptFlags;
+
+        if (raw.kind == TraceRecord::SNAPSHOT) {
+            record[0] = TraceRecord::SNAPSHOT;
+            memcpy(end, registers.aligned, sizeof(registers.aligned));
+            end += sizeof(registers.aligned);
+            *end++ = registers.status;
+            *end++ = registers.interruptFlags;
+            last = registers;
+            expectedPC = registers.PC;
+            out.resize(end - out.data());
+            return size;
+        }
+
+        Byte tag = raw.kind;
+        *end++ = raw.opcode;
+        end = TraceFormat::PutDelta(end, (int16_t)TraceFormat::WordDelta(raw.pc, registers.PC));
+        end = TraceFormat::PutVarint(end, raw.cycles);
+        if (raw.pc != expectedPC) {
+            tag |= TraceFormat::EXPLICIT_PC;
+            end = TraceFormat::PutDelta(end, (int16_t)TraceFormat::WordDelta(expectedPC, raw.pc));
+        }
+
+        Word changed = 0;
+        for (Byte reg = 0; reg < 6; reg++) {
+            changed |= (registers.aligned[reg] != last.aligned[reg]) << reg;
+        }
+        changed |= registers.SP != last.SP ? TraceFormat::MASK_SP : 0;
+        changed |= registers.status != last.status ? TraceFormat::MASK_STATUS : 0;
+        changed |= registers.interruptFlags != last.interruptFlags ? TraceFormat::MASK_INTERRUPTS : 0;
+        if (changed != 0) {
+            tag |= TraceFormat::REGISTERS;
+            end = TraceFormat::PutVarint(end, changed);
+            for (Byte reg = 0; reg < 6; reg++) {
+                if (changed & (1 << reg)) {
+                    end = TraceFormat::PutDelta(end, (int16_t)TraceFormat::WordDelta(last.aligned[reg], registers.aligned[reg]));
+                }
+            }
+            if (changed & TraceFormat::MASK_SP) {
+                end = TraceFormat::PutDelta(end, (int16_t)TraceFormat::WordDelta(last.SP, registers.SP));
+            }
+            if (changed & TraceFormat::MASK_STATUS) {
+                *end++ = registers.status;
+            }
+            if (changed & TraceFormat::MASK_INTERRUPTS) {
+                *end++ = registers.interruptFlags;
+            }
+            last = registers;
+        }
+
+        if (raw.writeCount != 0) {
+            tag |= TraceFormat::WRITES;
+            *end++ = raw.writeCount;
+            for (Byte i = 0; i < raw.writeCount; i++, payload += sizeof(RawWrite)) {
+                RawWrite write;
+                memcpy(&write, payload, sizeof(write));
+                bool isByte = (raw.flags >> i) & 1;
+
+                int64_t delta = (int16_t)TraceFormat::WordDelta(lastWriteAddress, write.address);
+                uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+                end = TraceFormat::PutVarint(end, (zigzag << 1) | isByte);
+                *end++ = write.value & 0xFF;
+                if (!isByte) {
+                    *end++ = write.value >> 8;
+                }
+                lastWriteAddress = write.address;
+            }
+        }
+
+        if (raw.flags & RAW_BLOCK) {
+            RawBlock rawBlock;
+            memcpy(&rawBlock, payload, sizeof(rawBlock));
+            tag |= TraceFormat::BLOCK;
+            *end++ = rawBlock.address & 0xFF;
+            *end++ = rawBlock.address >> 8;
+            end = TraceFormat::PutVarint(end, rawBlock.bytes);
+        }
+
+        record[0] = tag;
+        expectedPC = registers.PC;
+        out.resize(end - out.data());
+        return size;
+    }
+
+    void WriterLoop() {
+        std::vector<Byte> entries(BLOCK_SIZE);
+        std::vector<Byte> encoded;
+        std::vector<Byte> compressed;
+        std::vector<uint32_t> table;
+        size_t used = 0;
+        encoded.reserve(BLOCK_SIZE + TraceFormat::MAX_RECORD_SIZE);
+
+        while (true) {
+            bool stop = stopping.load(std::memory_order_acquire); //Read before popping so nothing pushed before Stop is missed
+            size_t popped = ring.Pop(&entries[used], BLOCK_SIZE - used);
+            used += popped;
+
+            size_t offset = 0;
+            while (size_t size = Encode(&entries[offset], used - offset, encoded)) {
+                offset += size;
+                if (encoded.size() >= BLOCK_SIZE) {
+                    WriteBlock(encoded, compressed, table);
+                }
+            }
+            memmove(&entries[0], &entries[offset], used - offset); //Keep a partially popped entry
+            used -= offset;
+
+            if (stop && popped == 0) {
+                break;
+            }
+            if (popped == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        if (!encoded.empty()) {
+            WriteBlock(encoded, compressed, table);
+        }
+        std::fflush(file);
+    }
+    void WriteBlock(std::vector<Byte>& encoded, std::vector<Byte>& compressed, std::vector<uint32_t>& table) {
+        TraceFormat::Compress(encoded.data(), encoded.size(), compressed, table);
+
+        Byte header[8];
+        for (int i = 0; i < 4; i++) {
+            header[i] = (Byte)(encoded.size() >> (i * 8));
+            header[4 + i] = (Byte)(compressed.size() >> (i * 8));
+        }
+        std::fwrite(header, 1, sizeof(header), file);
+        std::fwrite(compressed.data(), 1, compressed.size(), file);
+        encodedBytes += encoded.size();
+        fileBytes += sizeof(header) + compressed.size();
+        encoded.clear();
+    }
+};
+
+/// <summary>
+/// Sequential reader for files written by TraceRecorder
+/// </summary>
+struct TraceReader
+{
+    ~TraceReader() {
+        if (file != nullptr) {
+            std::fclose(file);
+        }
+    }
+
+    bool Open(const std::string& filename) {
+        file = std::fopen(filename.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        Byte header[sizeof(TraceFormat::MAGIC) + 1];
+        return std::fread(header, 1, sizeof(header), file) == sizeof(header)
+            && memcmp(header, TraceFormat::MAGIC, sizeof(TraceFormat::MAGIC)) == 0
+            && header[sizeof(TraceFormat::MAGIC)] == TraceFormat::VERSION;
+    }
+
+    //Decodes the next record, false at the end of the trace. Throws on a corrupt file
+    bool Next(TraceRecord& record) {
+        Fill();
+        if (position == data.size()) {
+            return false;
+        }
+
+        const Byte* in = data.data() + position;
+        const Byte* end = data.data() + data.size();
+        Byte tag = *in++;
+        record.kind = (TraceRecord::Kind)(tag & TraceFormat::KIND_MASK);
+        record.writes.clear();
+        record.hasBlock = false;
+
+        if (record.kind == TraceRecord::SNAPSHOT) {
+            if (end - in < (ptrdiff_t)sizeof(registers.aligned) + 2) {
+                throw std::runtime_error("ERROR: Truncated trace snapshot\n");
+            }
+            memcpy(registers.aligned, in, sizeof(registers.aligned));
+            in += sizeof(registers.aligned);
+            registers.status = *in++;
+            registers.interruptFlags = *in++;
+
+            record.opcode = 0;
+            record.pc = record.nextPC = registers.PC;
+            record.cycles = 0;
+            record.changedRegisters = 0xFFFF;
+            record.registers = registers;
+            expectedPC = registers.PC;
+            position = in - data.data();
+            return true;
+        }
+
+        int64_t delta;
+        uint64_t value;
+        in = Require(in, 1);
+        record.opcode = *in++;
+        in = Require(TraceFormat::GetDelta(in, end, delta), 0);
+        Word nextDelta = (Word)delta;
+        in = Require(TraceFormat::GetVarint(in, end, record.cycles), 0);
+        record.pc = expectedPC;
+        if (tag & TraceFormat::EXPLICIT_PC) {
+            in = Require(TraceFormat::GetDelta(in, end, delta), 0);
+            record.pc += (Word)delta;
+        }
+        record.nextPC = record.pc + nextDelta;
+        registers.PC = record.nextPC;
+        expectedPC = record.nextPC;
+
+        record.changedRegisters = 0;
+        if (tag & TraceFormat::REGISTERS) {
+            in = Require(TraceFormat::GetVarint(in, end, value), 0);
+            record.changedRegisters = (Word)value;
+            for (Byte reg = 0; reg < 6; reg++) {
+                if (value & (1 << reg)) {
+                    in = Require(TraceFormat::GetDelta(in, end, delta), 0);
+                    registers.aligned[reg] += (Word)delta;
+                }
+            }
+            if (value & TraceFormat::MASK_SP) {
+                in = Require(TraceFormat::GetDelta(in, end, delta), 0);
+                registers.SP += (Word)delta;
+            }
+            if (value & TraceFormat::MASK_STATUS) {
+                in = Require(in, 1);
+                registers.status = *in++;
+            }
+            if (value & TraceFormat::MASK_INTERRUPTS) {
+                in = Require(in, 1);
+                registers.interruptFlags = *in++;
+            }
+        }
+
+        if (tag & TraceFormat::WRITES) {
+            in = Require(in, 1);
+            Byte count = *in++;
+            for (Byte i = 0; i < count; i++) {
+                in = Require(TraceFormat::GetVarint(in, end, value), 0);
+                bool isByte = value & 1;
+                value >>= 1;
+                delta = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+                lastWriteAddress += (Word)delta;
+
+                in = Require(in, isByte ? 1 : 2);
+                Word written = in[0];
+                if (!isByte) {
+                    written |= in[1] << 8;
+                }
+                in += isByte ? 1 : 2;
+                record.writes.push_back(TraceRecord::MemoryWrite{ lastWriteAddress, written, isByte });
+            }
+        }
+
+        if (tag & TraceFormat::BLOCK) {
+            in = Require(in, 2);
+            record.hasBlock = true;
+            record.blockAddress = in[0] | (in[1] << 8);
+            in = Require(TraceFormat::GetVarint(in + 2, end, value), 0);
+            record.blockBytes = (DWord)value;
+        }
+
+        record.registers = registers;
+        position = in - data.data();
+        return true;
+    }
+
+private:
+    FILE* file = nullptr;
+    std::vector<Byte> data; //Decompressed bytes not yet decoded, plus the decoded prefix up to position
+    size_t position = 0;
+    std::vector<Byte> compressed;
+
+    Registers registers{};
+    Word expectedPC = 0;
+    Word lastWriteAddress = 0;
+
+    //Keeps at least one full record decompressed unless the file has ended
+    void Fill() {
+        if (data.size() - position >= TraceFormat::MAX_RECORD_SIZE) {
+            return;
+        }
+        data.erase(data.begin(), data.begin() + position);
+        position = 0;
+
+        Byte header[8];
+        while (data.size() < TraceFormat::MAX_RECORD_SIZE && file != nullptr
+            && std::fread(header, 1, sizeof(header), file) == sizeof(header)) {
+            DWord rawSize = header[0] | (header[1] << 8) | (header[2] << 16) | ((DWord)header[3] << 24);
+            DWord compressedSize = header[4] | (header[5] << 8) | (header[6] << 16) | ((DWord)header[7] << 24);
+
+            compressed.resize(compressedSize);
+            size_t before = data.size();
+            if (std::fread(compressed.data(), 1, compressedSize, file) != compressedSize
+                || !TraceFormat::Decompress(compressed.data(), compressedSize, data)
+                || data.size() - before != rawSize) {
+                throw std::runtime_error("ERROR: Corrupt trace block\n");
+            }
+        }
+    }
+    //Bounds check for the record being decoded
+    const Byte* Require(const Byte* in, size_t bytes) const {
+        if (in == nullptr || (size_t)(data.data() + data.size() - in) < bytes) {
+            throw std::runtime_error("ERROR: Truncated trace record\n");
+        }
+        return in;
+    }
+};
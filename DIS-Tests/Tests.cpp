@@ -0,0 +1,394 @@
+#include "../DIS-Assembler/assembler.h"
+#include "../DIS-Emulator/blockdevice.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+#ifndef DIS_TESTS_PROGRAMS
+#define DIS_TESTS_PROGRAMS "programs" //Relative to the working directory, which is the project directory in Visual Studio
+#endif
+
+/// <summary>
+/// Regression tests, run by ctest in the CMake build. Every test prints PASS or FAIL with the reason and the exit code is the
+/// number of failed tests. A test fails by throwing, Require is the usual way.
+/// Programs in programs/*.dis run until HALT and list the registers they must end with in "; expect r0=0x0001 r4=0x0325" lines
+/// </summary>
+
+//The shipped CPU configuration without console messages
+struct TestCPUPolicy : CPUPolicy
+{
+    static constexpr bool Logging = false;
+};
+using TestCPU = BasicCPU<TestCPUPolicy>;
+
+struct ProgramRun
+{
+    Memory mem{};
+    TestCPU cpu{};
+    std::vector<Byte> progmem;
+};
+
+static void Require(bool condition, const std::string& message) {
+    if (!condition) {
+        throw Except(message.c_str());
+    }
+}
+
+static std::string Hex(Word value) {
+    char text[8];
+    std::snprintf(text, sizeof(text), "0x%04X", value);
+    return text;
+}
+
+static std::string LoadProgram(const std::string& name) {
+    std::string path = std::string(DIS_TESTS_PROGRAMS) + "/" + name + ".dis";
+    std::ifstream stream(path);
+    if (!stream) {
+        throw Except(("ERROR: Cannot open program " + path).c_str());
+    }
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    return buffer.str();
+}
+
+//Assembles the source into the memory of a reset CPU
+static std::unique_ptr<ProgramRun> LoadRun(const std::string& source, bool optimize = false) {
+    auto run = std::make_unique<ProgramRun>();
+    SymbolMap symbolMap;
+    AsmOptions options;
+    options.verbose = false;
+    options.optimize = optimize;
+    ParseAssembly(source, run->progmem, symbolMap, options);
+
+    run->cpu.Reset(run->mem);
+    memcpy(run->mem.Data, run->progmem.data(), run->progmem.size());
+    return run;
+}
+//Runs the source until HALT, a program still running after the cycle limit fails the test
+static std::unique_ptr<ProgramRun> RunProgram(const std::string& source, bool optimize, i64 cycles = 10000000) {
+    auto run = LoadRun(source, optimize);
+    run->cpu.Execute(cycles, run->mem);
+    Require(run->cpu.halted, "Program did not halt");
+    return run;
+}
+
+//Checks the "; expect rN=0xXXXX" lines of the source
+static void RequireExpected(const std::string& source, const TestCPU& cpu, const char* variant) {
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.rfind("; expect ", 0) != 0) {
+            continue;
+        }
+        std::istringstream fields(line.substr(9));
+        std::string field;
+        while (fields >> field) {
+            Require(field.size() > 3 && field[0] == 'r' && field[2] == '=', "Malformed expectation " + field);
+            Byte reg = (Byte)(field[1] - '0');
+            Word expected = (Word)std::stoul(field.substr(3), nullptr, 0);
+            Require(cpu.registers[reg] == expected, std::string(variant) + ": r" + field[1] + " is " + Hex(cpu.registers[reg]) +
+                ", expected " + Hex(expected));
+        }
+    }
+}
+
+//Every program runs with and without -O, the optimizer must not change what it computes
+static const char* programs[] = {
+    "optimizer_flags",
+    "optimizer_pc",
+    "flags_overflow",
+    "address_labels",
+};
+static void TestPrograms() {
+    for (const char* name : programs) {
+        std::string source = LoadProgram(name);
+        auto plain = RunProgram(source, false);
+        auto optimized = RunProgram(source, true);
+        RequireExpected(source, plain->cpu, name);
+        RequireExpected(source, optimized->cpu, (std::string(name) + " -O").c_str());
+        for (Byte reg = 0; reg < 8; reg++) {
+            if (reg != 6) { //The optimized program is shorter, it halts at a different address
+                Require(plain->cpu.registers[reg] == optimized->cpu.registers[reg], std::string(name) + ": r" +
+                    std::to_string(reg) + " differs with -O");
+            }
+        }
+        Require(plain->cpu.registers.status == optimized->cpu.registers.status, std::string(name) + ": flags differ with -O");
+    }
+}
+
+//An interrupt raised while the handler runs is taken as soon as it re-enables interrupts, which must not clobber its return.
+//Each round raises an interrupt, stops inside the handler one cycle later than the last round and raises the next one
+static void TestInterruptReturn() {
+    auto run = LoadRun(LoadProgram("interrupt_return"));
+    TestCPU& cpu = run->cpu;
+    cpu.Execute(100, run->mem);
+    for (Word round = 1; round <= 40; round++) {
+        cpu.SetInterrupt(I_0);
+        cpu.Execute(round, run->mem);
+        cpu.SetInterrupt(I_0);
+        Word loops = cpu.registers.R3;
+        cpu.Execute(200, run->mem);
+        Require(cpu.registers.R0 == round * 2, "Handled " + std::to_string(cpu.registers.R0) + " of " + std::to_string(round * 2) + " interrupts");
+        Require(cpu.registers.R3 != loops, "Main loop stuck after round " + std::to_string(round));
+        Require(cpu.registers.SP == 0xF000, "Stack is unbalanced after round " + std::to_string(round));
+    }
+}
+
+//CPU::Run sleeps while the guest waits and runs a slice per interrupt, instead of spinning through idle budgets
+static void TestWaitRunner() {
+    const i64 slice = 100000;
+    auto run = LoadRun(LoadProgram("wait_runner"));
+    std::atomic<bool> stop{ false };
+    std::thread runner([&] { run->cpu.RunUntilStopped(slice, run->mem, stop); });
+    for (int i = 0; i < 5; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        run->cpu.SetInterrupt((Interrupt)(1 << i)); //A different interrupt each time, so none is merged with a pending one
+    }
+    runner.join();
+    Require(run->cpu.halted && run->cpu.registers.R0 == 5, "Handled " + std::to_string(run->cpu.registers.R0) + " of 5 interrupts");
+    Require(run->cpu.elapsed < (uint64_t)slice * 20, "Runner spun through " + std::to_string(run->cpu.elapsed) + " idle cycles");
+
+    //Shutdown of a runner blocked in WaitForInterrupt
+    auto idle = LoadRun(LoadProgram("wait_forever"));
+    std::thread blocked([&] { idle->cpu.RunUntilStopped(slice, idle->mem, stop); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    stop.store(true, std::memory_order_release);
+    idle->cpu.Wake();
+    blocked.join();
+    Require(idle->cpu.waiting && !idle->cpu.halted, "The guest should still be waiting");
+    Require(idle->cpu.elapsed <= (uint64_t)slice, "Runner executed more than one slice while waiting");
+}
+
+//A file of five full 64 byte buffers and a short one for block_stream.dis. Returns the sum of its words
+static const Word streamBufferBytes = 0x40;
+static const size_t streamFileBytes = streamBufferBytes * 5 + 22;
+static Word WriteStreamFile(const std::filesystem::path& path) {
+    std::vector<Byte> contents(streamFileBytes);
+    Word sum = 0;
+    for (size_t i = 0; i < streamFileBytes; i++) {
+        contents[i] = (Byte)(i * 7 + 3);
+        if (i % 2 == 1) {
+            sum += contents[i - 1] | (contents[i] << 8);
+        }
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(contents.data()), contents.size());
+    return sum;
+}
+static void RequireStreamed(const TestCPU& cpu, Word sum, const char* variant) {
+    Require(cpu.halted, std::string(variant) + ": the guest never saw STATUS_END");
+    Require(cpu.registers.R3 == 6 && cpu.registers.R4 == streamFileBytes, std::string(variant) + ": read " +
+        std::to_string(cpu.registers.R4) + " bytes in " + std::to_string(cpu.registers.R3) + " buffers");
+    Require(cpu.registers.R5 == sum, std::string(variant) + ": sum " + Hex(cpu.registers.R5) + ", expected " + Hex(sum));
+}
+
+//A guest streams the file through BlockDevice, the host services it between slices.
+//The debugger watches the second buffer, the DMA writes into it have to reach it. Replaying the InputLog of the run
+//without the device has to stream the same data
+static void TestBlockStream() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "DIS-Tests-stream.bin";
+    Word sum = WriteStreamFile(path);
+
+    auto run = LoadRun(LoadProgram("block_stream"));
+    Debugger debugger;
+    debugger.AddWatchpoint(run->mem, 0x4040, streamBufferBytes, Memory::PAGE_WATCH_WRITE);
+    run->cpu.debugger = &debugger;
+    InputLog log;
+    run->cpu.inputLog = &log;
+    BlockDevice device;
+    device.interrupt = (Interrupt)0; //The guest polls
+    bool opened = device.Open(path.string());
+    for (int slice = 0; opened && slice < 10000 && !run->cpu.halted; slice++) {
+        run->cpu.Execute(50, run->mem);
+        device.Service(run->cpu, run->mem);
+    }
+    device.Close();
+    std::filesystem::remove(path);
+
+    Require(opened, "Cannot open " + path.string());
+    RequireStreamed(run->cpu, sum, "recorded");
+    Require(run->mem[BlockDevice::REGISTERS + BlockDevice::REG_TRANSFERRED] == 22, "The last buffer is not short");
+    Require(debugger.reason == Debugger::STOP_WRITE_WATCH && debugger.dataAddress == 0x4040, "The debugger missed the DMA write");
+
+    auto replay = LoadRun(LoadProgram("block_stream"));
+    replay->cpu.inputLog = &log;
+    log.StartReplay();
+    for (int slice = 0; slice < 10000 && !replay->cpu.halted; slice++) {
+        replay->cpu.Execute(50, replay->mem);
+    }
+    RequireStreamed(replay->cpu, sum, "replayed");
+    Require(replay->cpu.retired == run->cpu.retired && memcmp(replay->mem.Data, run->mem.Data, Memory::MEM_SIZE) == 0,
+        "The replay ends in a different state");
+}
+
+//Going back over the streaming run has to re-apply the device's transfers and register updates between the slices.
+//Every few slices the state is kept, going back to each of them from the end has to restore it
+static void TestBlockHistory() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "DIS-Tests-history.bin";
+    Word sum = WriteStreamFile(path);
+
+    auto run = LoadRun(LoadProgram("block_stream"));
+    ExecutionHistory history;
+    history.interval = 200;
+    run->cpu.history = &history;
+    BlockDevice device;
+    device.interrupt = (Interrupt)0;
+    bool opened = device.Open(path.string());
+    struct Kept {
+        uint64_t retired;
+        Registers registers;
+        std::vector<Byte> memory;
+    };
+    std::vector<Kept> kept;
+    for (int slice = 0; opened && slice < 10000 && !run->cpu.halted; slice++) {
+        run->cpu.Execute(50, run->mem);
+        if (slice % 4 == 1) {
+            kept.push_back(Kept{ run->cpu.retired, run->cpu.registers, std::vector<Byte>(run->mem.Data, run->mem.Data + Memory::MEM_SIZE) });
+        }
+        device.Service(run->cpu, run->mem);
+    }
+    device.Close();
+    std::filesystem::remove(path);
+
+    Require(opened, "Cannot open " + path.string());
+    RequireStreamed(run->cpu, sum, "with history");
+    Require(history.StepBack(run->cpu, run->mem) && history.StepBack(run->cpu, run->mem), "Cannot step back from HALT");
+    for (size_t i = kept.size(); i-- > 0;) {
+        const Kept& state = kept[i];
+        if (state.retired >= run->cpu.retired) {
+            continue; //Passed by the steps
+        }
+        Require(history.RunBackTo(run->cpu, run->mem, state.retired), "Cannot go back to " + std::to_string(state.retired) +
+            ", stopped at " + std::to_string(run->cpu.retired));
+        Require(memcmp(run->cpu.registers.aligned, state.registers.aligned, sizeof(state.registers.aligned)) == 0 &&
+            run->cpu.registers.status == state.registers.status, "Registers differ at " + std::to_string(state.retired));
+        Require(memcmp(run->mem.Data, state.memory.data(), Memory::MEM_SIZE) == 0, "Memory differs at " + std::to_string(state.retired));
+    }
+}
+
+//Operand of the kind the assembler parses for an OPCODES operand
+static Type ArgumentType(const OpcodeInfo& info, OperandKind kind) {
+    switch (kind)
+    {
+    case OPERAND_REGISTER: return Type_Register;
+    case OPERAND_BYTE: return Type_Byte;
+    case OPERAND_MEMORY:
+    case OPERAND_POINTER: return info.registerMode ? Type_AddressRegister : Type_Address;
+    case OPERAND_TARGET: return info.registerMode ? Type_Register : Type_Word;
+    case OPERAND_RELATIVE: return Type_Relative;
+    default: return Type_Word;
+    }
+}
+//Every instruction byte in OPCODES, written the way the disassembler prints it, has to assemble to that byte and length.
+//Ties the assembler's opcode selection and sizes to the table the disassembler and tools decode with
+static void TestEncoding() {
+    for (int instByte = 0; instByte < 256; instByte++) {
+        const OpcodeInfo& info = OPCODES[instByte];
+        //BRK is patched in by the Debugger and has no syntax. Without an addressing mode the bit is ignored, the assembler leaves it clear
+        if (!info.Valid() || instByte == OP_BRK || ((instByte & 0x80) && info.mode == MODE_NONE)) {
+            continue;
+        }
+        std::string form = std::string(info.mnemonic) + " " + Hex((Word)instByte);
+        AsmInstruction asmInst{ ParseAssemblyInstruction(info.mnemonic), info.operandCount, {} };
+        for (Byte i = 0; i < info.operandCount; i++) {
+            Byte index = info.storeOrder ? info.operandCount - 1 - i : i;
+            asmInst.args[i] = AsmArgument{ ArgumentType(info, info.operands[index]), (Word)(i + 1) };
+        }
+        Opcode opcode;
+        try {
+            opcode = GetOpcode(asmInst);
+        }
+        catch (const std::exception& e) {
+            throw Except((form + ": " + e.what()).c_str());
+        }
+        Require(opcode == instByte, form + " assembles to " + Hex(opcode));
+        Require(GetInstructionSize(asmInst, 0) == info.length, form + " assembles to " + std::to_string(GetInstructionSize(asmInst, 0)) +
+            " bytes, OPCODES has " + std::to_string(info.length));
+    }
+}
+
+//The writer thread only stores the registers that changed since the previous record. Decoding the trace has to give the CPU
+//state after every slice, including the registers the host changed between slices
+struct TraceCPUPolicy : TestCPUPolicy
+{
+    static constexpr bool Tracing = true;
+};
+static void TestTraceRegisters() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "DIS-Tests-trace.dtr";
+    std::vector<const char*> names(std::begin(programs), std::end(programs));
+    names.push_back("interrupt_return");
+    for (const char* name : names) {
+        auto run = LoadRun(LoadProgram(name));
+        BasicCPU<TraceCPUPolicy> cpu{};
+        cpu.Reset(run->mem);
+        memcpy(run->mem.Data, run->progmem.data(), run->progmem.size());
+
+        TraceRecorder tracer;
+        Require(tracer.Start(path.string(), cpu.registers), "Cannot create " + path.string());
+        cpu.tracer = &tracer;
+        std::vector<std::pair<uint64_t, Registers>> slices; //Records so far and the registers after each slice
+        for (int slice = 0; slice < 200 && !cpu.halted; slice++) {
+            if (slice % 3 == 2) {
+                cpu.registers.R2 ^= 0x5A5A;
+                cpu.SetInterrupt(I_0);
+            }
+            cpu.Execute(37, run->mem);
+            slices.emplace_back(tracer.records, cpu.registers);
+        }
+        tracer.Stop();
+
+        TraceReader reader;
+        Require(reader.Open(path.string()), std::string(name) + ": cannot open the trace");
+        TraceRecord record;
+        uint64_t decoded = 0;
+        reader.Next(record); //Snapshot
+        for (const auto& [records, registers] : slices) {
+            while (decoded < records && reader.Next(record)) {
+                decoded++;
+            }
+            Require(decoded == records, std::string(name) + ": the trace ends after " + std::to_string(decoded) + " records");
+            Require(memcmp(record.registers.aligned, registers.aligned, sizeof(registers.aligned)) == 0 &&
+                record.registers.status == registers.status && record.registers.interruptFlags == registers.interruptFlags,
+                std::string(name) + ": registers differ after record " + std::to_string(records));
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+struct Test
+{
+    const char* name;
+    void (*run)();
+};
+static const Test tests[] = {
+    { "programs", TestPrograms },
+    { "interrupt_return", TestInterruptReturn },
+    { "wait_runner", TestWaitRunner },
+    { "block_stream", TestBlockStream },
+    { "block_history", TestBlockHistory },
+    { "trace_registers", TestTraceRegisters },
+    { "encoding", TestEncoding },
+};
+
+int main(int argc, char* argv[])
+{
+    //Usage: DIS-Tests [test name]
+    std::string_view only = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    for (const Test& test : tests) {
+        if (!only.empty() && only != test.name) {
+            continue;
+        }
+        try {
+            test.run();
+            printf("PASS %s\n", test.name);
+        }
+        catch (const std::exception& e) {
+            printf("FAIL %s: %s\n", test.name, e.what());
+            failed++;
+        }
+    }
+    return failed;
+}
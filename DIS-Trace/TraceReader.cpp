@@ -0,0 +1,193 @@
+#include "../DIS-Emulator/cpu.h"
+#include "../DIS-Emulator/disassembler.h"
+#include <fstream>
+#include <iterator>
+#include <string_view>
+
+struct TraceFilter
+{
+    Word from = 0x0000;
+    Word to = 0xFFFF;   //Inclusive
+    bool summaryOnly = false;
+
+    bool Matches(const TraceRecord& record) const {
+        return record.pc >= from && record.pc <= to;
+    }
+};
+
+//Instruction text from the program image, or the mnemonic when the image does not hold this instruction (e.g. it was patched at run time)
+void FormatInstruction(const TraceRecord& record, const Disassembler& disassembler, char* text)
+{
+    DecodedInstruction inst;
+    if (disassembler.Decode(record.pc, inst) && inst.instByte == record.opcode) {
+        disassembler.Format(inst, text);
+        return;
+    }
+    const OpcodeInfo& info = OPCODES[record.opcode];
+    std::snprintf(text, Disassembler::MAX_TEXT, "op 0x%02X %s", record.opcode, info.Valid() ? info.mnemonic : "?");
+}
+
+void PrintRecord(uint64_t index, const TraceRecord& record, const SymbolMap& symbols, const Disassembler& disassembler)
+{
+    static const char* registerNames[] = { "r0", "r1", "r2", "r3", "r4", "r5" };
+
+    switch (record.kind)
+    {
+    case TraceRecord::SNAPSHOT:
+        printf("%8llu  snapshot pc=0x%04X sp=0x%04X r0=0x%04X r1=0x%04X r2=0x%04X r3=0x%04X r4=0x%04X r5=0x%04X status=0x%02X\n",
+            (unsigned long long)index, record.registers.PC, record.registers.SP,
+            record.registers.R0, record.registers.R1, record.registers.R2, record.registers.R3, record.registers.R4, record.registers.R5,
+            record.registers.status);
+        return;
+    case TraceRecord::INTERRUPT:
+        printf("%8llu  %-24s interrupt 0x%02X -> %s", (unsigned long long)index, symbols.Symbolize(record.pc).c_str(),
+            record.opcode, symbols.Symbolize(record.nextPC).c_str());
+        break;
+    default:
+        char text[Disassembler::MAX_TEXT];
+        FormatInstruction(record, disassembler, text);
+        printf("%8llu  %-24s %-28s %3llu cycles", (unsigned long long)index, symbols.Symbolize(record.pc).c_str(),
+            text, (unsigned long long)record.cycles);
+        if (record.nextPC != record.pc) {
+            printf(" -> 0x%04X", record.nextPC);
+        }
+        break;
+    }
+
+    for (Byte reg = 0; reg < 6; reg++) {
+        if (record.changedRegisters & (1 << reg)) {
+            printf(" %s=0x%04X", registerNames[reg], record.registers[reg]);
+        }
+    }
+    if (record.changedRegisters & TraceFormat::MASK_SP) {
+        printf(" sp=0x%04X", record.registers.SP);
+    }
+    if (record.changedRegisters & TraceFormat::MASK_STATUS) {
+        printf(" status=0x%02X", record.registers.status);
+    }
+    if (record.changedRegisters & TraceFormat::MASK_INTERRUPTS) {
+        printf(" interrupts=0x%02X", record.registers.interruptFlags);
+    }
+    for (const TraceRecord::MemoryWrite& write : record.writes) {
+        printf(write.isByte ? " [0x%04X]=0x%02X" : " [0x%04X]=0x%04X", write.address, write.value);
+    }
+    if (record.hasBlock) {
+        printf(" [0x%04X..+%u]", record.blockAddress, record.blockBytes);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    //Usage: DIS-Trace [-from address] [-to address] [-sym symbol file] [-image program image] [-summary] <trace file>
+    //       DIS-Trace -list [-linear] [-sym symbol file] [-image program image] [trace file]
+    TraceFilter filter;
+    std::string symbolPath = "program.sym";
+    std::string imagePath = "program.disa";
+    const char* tracePath = nullptr;
+    bool list = false;
+    bool linear = false;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "-from" && i + 1 < argc) {
+            filter.from = (Word)std::stoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-to" && i + 1 < argc) {
+            filter.to = (Word)std::stoul(argv[++i], nullptr, 0);
+        }
+        else if (arg == "-sym" && i + 1 < argc) {
+            symbolPath = argv[++i];
+        }
+        else if (arg == "-image" && i + 1 < argc) {
+            imagePath = argv[++i];
+        }
+        else if (arg == "-summary") {
+            filter.summaryOnly = true;
+        }
+        else if (arg == "-list") {
+            list = true;
+        }
+        else if (arg == "-linear") {
+            linear = true;
+        }
+        else {
+            tracePath = argv[i];
+        }
+    }
+    if (tracePath == nullptr && !list) {
+        printf("Usage: DIS-Trace [-from address] [-to address] [-sym symbol file] [-image program image] [-summary] <trace file>\n");
+        printf("       DIS-Trace -list [-linear] [-sym symbol file] [-image program image] [trace file]\n");
+        return 1;
+    }
+
+    SymbolMap symbols;
+    symbols.Load(symbolPath); //Optional, addresses are printed raw without it
+
+    //Optional, instructions are printed as opcode and mnemonic without it. Loaded at 0x0000 like DIS-Assembler does
+    std::ifstream imageFile(imagePath, std::ios::binary);
+    std::vector<Byte> image((std::istreambuf_iterator<char>(imageFile)), std::istreambuf_iterator<char>());
+    Disassembler disassembler(image.data(), image.size(), 0, &symbols);
+
+    if (list) {
+        //Follows control flow from .main and from every traced instruction, or decodes everything with -linear
+        if (image.empty()) {
+            printf("ERROR: %s is not a program image\n", imagePath.c_str());
+            return 1;
+        }
+        if (linear) {
+            disassembler.Listing(stdout);
+            return 0;
+        }
+        std::vector<Word> entries = { 0 };
+        TraceReader reader;
+        if (tracePath != nullptr) {
+            if (!reader.Open(tracePath)) {
+                printf("ERROR: %s is not a trace file\n", tracePath);
+                return 1;
+            }
+            TraceRecord record;
+            std::vector<bool> seen(Memory::MEM_SIZE);
+            while (reader.Next(record)) {
+                if (record.kind == TraceRecord::INSTRUCTION && !seen[record.pc]) {
+                    seen[record.pc] = true;
+                    entries.push_back(record.pc);
+                }
+            }
+        }
+        std::vector<bool> code = disassembler.FollowFlow(entries);
+        disassembler.Listing(stdout, &code);
+        return 0;
+    }
+
+    TraceReader reader;
+    if (!reader.Open(tracePath)) {
+        printf("ERROR: %s is not a trace file\n", tracePath);
+        return 1;
+    }
+
+    uint64_t index = 0;
+    uint64_t matched = 0;
+    uint64_t instructions = 0;
+    uint64_t interrupts = 0;
+    uint64_t cycles = 0;
+    TraceRecord record;
+    while (reader.Next(record)) {
+        instructions += record.kind == TraceRecord::INSTRUCTION;
+        interrupts += record.kind == TraceRecord::INTERRUPT;
+        cycles += record.cycles;
+
+        if (record.kind == TraceRecord::SNAPSHOT || filter.Matches(record)) {
+            matched += record.kind != TraceRecord::SNAPSHOT;
+            if (!filter.summaryOnly) {
+                PrintRecord(index, record, symbols, disassembler);
+            }
+        }
+        index++;
+    }
+
+    printf("\nTRACE SUMMARY:\n");
+    printf("Instructions:       %llu\n", (unsigned long long)instructions);
+    printf("Interrupts:         %llu\n", (unsigned long long)interrupts);
+    printf("Cycles:             %llu\n", (unsigned long long)cycles);
+    printf("Records in range:   %llu (0x%04X - 0x%04X)\n", (unsigned long long)matched, filter.from, filter.to);
+}